@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/*
+ * Log messages are formatted by the calling thread into a slot of a
+ * lock-free ring and written to stdout by a background thread, so
+ * writing to a slow terminal or pipe doesn't block tick, receive and
+ * planner threads. When the ring is full, messages are dropped and counted.
+ */
+
+struct log_slot {
+    atomic_uint seq;
+    int level;
+    struct timespec ts;
+    char msg[LOG_MSG_LEN];
+};
+
+static struct log_slot ring[LOG_RING_LEN];
+static atomic_uint ring_head;
+static atomic_uint ring_tail;
+
+static atomic_int runtime_level = LOG_LEVEL_DEBUG;
+static atomic_uint dropped;
+static atomic_bool running;
+
+static struct timespec start_ts;
+static pthread_t tid_flush;
+
+static const char level_char[] = {'E', 'W', 'I', 'D'};
+
+// only flush thread moves tail
+static bool log_pop(void)
+{
+    unsigned tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    struct log_slot *slot = &ring[tail % LOG_RING_LEN];
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq != tail + 1)
+        return false;
+
+    long sec = slot->ts.tv_sec - start_ts.tv_sec;
+    long nsec = slot->ts.tv_nsec - start_ts.tv_nsec;
+    if (nsec < 0)
+    {
+        sec--;
+        nsec += 1000000000L;
+    }
+    printf("%ld.%06ld %c %s\n", sec, nsec / 1000, level_char[slot->level], slot->msg);
+
+    atomic_store_explicit(&slot->seq, tail + LOG_RING_LEN, memory_order_release);
+    atomic_store_explicit(&ring_tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static void *flush_thread(void *arg)
+{
+    while (true)
+    {
+        bool any = false;
+        while (log_pop())
+            any = true;
+        if (any)
+        {
+            fflush(stdout);
+            continue;
+        }
+        if (!atomic_load(&running))
+            break;
+        usleep(1000);
+    }
+    return NULL;
+}
+
+void log_message(int level, const char *fmt, ...)
+{
+    if (level > atomic_load_explicit(&runtime_level, memory_order_relaxed))
+        return;
+
+    struct log_slot *slot;
+    unsigned pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    while (true)
+    {
+        slot = &ring[pos % LOG_RING_LEN];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // ring is full
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        }
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(slot->msg, LOG_MSG_LEN, fmt, args);
+    va_end(args);
+    slot->level = level;
+    clock_gettime(CLOCK_MONOTONIC, &slot->ts);
+
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+uint32_t log_dropped(void)
+{
+    return atomic_exchange(&dropped, 0);
+}
+
+// Wait until all messages, logged before this call, are written
+void log_flush(void)
+{
+    unsigned head = atomic_load(&ring_head);
+    while ((int)(head - atomic_load_explicit(&ring_tail, memory_order_acquire)) > 0 &&
+           atomic_load(&running))
+        usleep(1000);
+    fflush(stdout);
+}
+
+void log_init(int level)
+{
+    unsigned i;
+    for (i = 0; i < LOG_RING_LEN; i++)
+        atomic_init(&ring[i].seq, i);
+    atomic_init(&ring_head, 0);
+    atomic_init(&ring_tail, 0);
+    atomic_init(&dropped, 0);
+    atomic_init(&runtime_level, level);
+    atomic_init(&running, true);
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    pthread_create(&tid_flush, NULL, flush_thread, NULL);
+}
+
+void log_shutdown(void)
+{
+    uint32_t n;
+    atomic_store(&running, false);
+    pthread_join(tid_flush, NULL);
+    n = log_dropped();
+    if (n > 0)
+        printf("%u log messages dropped\n", (unsigned)n);
+    fflush(stdout);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+
+enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+};
+
+// Messages above this level are not compiled in
+#ifndef CONFIG_EMULATION_LOG_LEVEL
+#define CONFIG_EMULATION_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_LEN 1024
+#define LOG_MSG_LEN  120
+
+void log_init(int level);
+void log_flush(void);
+void log_shutdown(void);
+
+// messages, dropped since previous call
+uint32_t log_dropped(void);
+
+void log_message(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_at(level, ...) \
+    do { \
+        if ((level) <= CONFIG_EMULATION_LOG_LEVEL) \
+            log_message((level), __VA_ARGS__); \
+    } while (0)
+
+#define log_error(...)   log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warning(...) log_at(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define log_info(...)    log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...)   log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
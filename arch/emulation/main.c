@@ -1,11 +1,13 @@
 #include <math.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <termios.h>
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -19,6 +21,10 @@
 #include <control/moves/moves.h>
 #include <control/commands/status/print_status.h>
 
+#include "log.h"
+#include "trace-emu.h"
+#include "modbus-emu.h"
+
 static void print_pos(void);
 
 
@@ -27,6 +33,10 @@ int steps[3];
 double pos[3];
 bool run = false;
 
+/* emulated probe surface, Z is directed to bottom */
+static bool probe_en = false;
+static double probe_z;
+
 static void set_dir(int coord, bool dir)
 {
     if (dir == true)
@@ -47,7 +57,7 @@ static cnc_endstops get_stops(void)
         .stop_x  = (pos[0] <= 0) && CONFIG_EMULATE_ENDSTOPS,
         .stop_y  = (pos[1] <= 0) && CONFIG_EMULATE_ENDSTOPS,
         .stop_z  = (pos[2] <= 0) && CONFIG_EMULATE_ENDSTOPS,
-        .probe = 0,
+        .probe = probe_en && pos[2] >= probe_z,
     };
 
     return stops;
@@ -59,13 +69,15 @@ pthread_t tid_tick; /* идентификатор потока */
 #ifdef CONFIG_PROTECT_STACK
 void __wrap___stack_chk_fail(void)
 {
-    printf("Stack protection failed!\n");
+    log_error("Stack protection failed!");
+    log_shutdown();
     exit(0);
 }
 #endif
 
 static void* make_tick(void *arg)
 {
+    trace_thread("tick");
     while (line_st)
     {
         int delay_us = moves_step_tick();
@@ -81,7 +93,7 @@ static void* make_tick(void *arg)
 
 static void line_started(void)
 {
-    printf("Line started\n");
+    log_debug("Line started");
     print_pos();
     line_st = true;
     pthread_create(&tid_tick, NULL, make_tick, NULL);
@@ -89,7 +101,7 @@ static void line_started(void)
 
 static void line_finished(void)
 {
-    printf("Line finished\n");
+    log_debug("Line finished");
     line_st = false;
     pthread_join(tid_tick, NULL);
     print_pos();
@@ -97,7 +109,7 @@ static void line_finished(void)
 
 static void line_error(void)
 {
-    printf("Line error\n");
+    log_warning("Line error");
     line_st = false;
     pthread_join(tid_tick, NULL);
     print_pos();
@@ -111,7 +123,7 @@ static void print_pos(void)
     y = position.pos[1];
     z = position.pos[2];
 
-    printf("Position = %i %i %i\n", x, y, z);
+    log_debug("Position = %i %i %i", x, y, z);
 }
 
 static void reboot(void)
@@ -125,15 +137,20 @@ static void reboot(void)
     pos[2] = 0;
     moves_reset();
     output_control_write("Hello", -1);
-    printf("Reboot\n");
+    log_info("Reboot");
 }
 
 static void set_gpio(int i, int on)
 {
     if (on)
-        printf("Tool %i in on\n", i);
+        log_info("Tool %i in on", i);
     else
-        printf("Tool %i is off\n", i);
+        log_info("Tool %i is off", i);
+}
+
+static void set_pwm(int i, int duty)
+{
+    log_info("Tool %i duty %i", i, duty);
 }
 
 void config_steppers(steppers_definition *sd, gpio_definition *gd)
@@ -146,11 +163,13 @@ void config_steppers(steppers_definition *sd, gpio_definition *gd)
     sd->line_finished  = line_finished;
     sd->line_error     = line_error;
     gd->set_gpio       = set_gpio;
+    gd->modbus_write   = modbus_emu_write;
+    gd->set_pwm        = set_pwm;
 }
 
 static void init_steppers(void)
 {
-    gpio_definition gd;
+    gpio_definition gd = {};
     steppers_definition sd = {};
     config_steppers(&sd, &gd);
     init_control(&sd, &gd);
@@ -167,6 +186,31 @@ void test_init(void)
 }
 
 pthread_mutex_t mutex;
+sem_t events_sem;
+
+static void events_notify(void)
+{
+    sem_post(&events_sem);
+}
+
+// wait for events of moves, but not more than timeout
+static void wait_events(long timeout_us)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += timeout_us * 1000;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    if (sem_timedwait(&events_sem, &ts) == 0)
+    {
+        /* events are drained together, so pending posts are taken too */
+        while (sem_trywait(&events_sem) == 0)
+            ;
+    }
+}
 static int fd;
 
 void *receive(void *arg)
@@ -174,7 +218,8 @@ void *receive(void *arg)
     static char buf[1000];
     ssize_t blen = 0;
 
-    printf("Starting recv thread. fd = %i\n", fd);
+    trace_thread("receive");
+    log_info("Starting recv thread. fd = %i", fd);
     while (run)
     {
         unsigned char b;
@@ -183,7 +228,7 @@ void *receive(void *arg)
 
         if (n < 1)
         {
-            printf("Disconnected\n");
+            log_info("Disconnected");
             run = false;
             break;
         }
@@ -191,13 +236,19 @@ void *receive(void *arg)
         {
             if (blen >= 3 && !memcmp(buf, "RT:", 3))
             {
+                TRACE_BEGIN("mutex_wait");
                 pthread_mutex_lock(&mutex);
-                printf("Execute: %.*s\n", (int)(blen - 3), buf + 3);
+                TRACE_END("mutex_wait");
+                log_debug("Execute: %.*s", (int)(blen - 3), buf + 3);
                 const unsigned char *cmd = buf + 3;
                 ssize_t cmdlen = blen - 3;
                 execute_g_command(cmd, cmdlen);
                 pthread_mutex_unlock(&mutex);
             }
+            else if (modbus_emu_command(buf, blen, output_control_write))
+            {
+                // Done
+            }
             else if (blen >= 5 && !memcmp(buf, "EXIT:", 5))
             {
                 run = false;
@@ -219,7 +270,7 @@ void *receive(void *arg)
 
 static ssize_t write_fun(int fd, const void *data, ssize_t len)
 {
-    printf("Send line: %.*s\n", (int)len, (const char*)data);
+    log_debug("Send line: %.*s", (int)len, (const char*)data);
     if (fd == 0)
     {
         write(fd, data, len);
@@ -245,7 +296,7 @@ static int create_control(unsigned short port)
 
     if (bind(ctlsock, (struct sockaddr *)&ctl_sockaddr, sizeof(ctl_sockaddr)) < 0)
     {
-        printf("Can not bind tcp\n");
+        log_error("Can not bind tcp");
         return -1;
     }
     listen(ctlsock, 1);
@@ -256,22 +307,53 @@ int main(int argc, const char **argv)
 {
     pthread_t tid_rcv; /* идентификатор потока */
     const int port = CONFIG_TCP_PORT;
-    
+    int level = LOG_LEVEL_DEBUG;
+#ifdef CONFIG_TRACE
+    const char *trace_path = NULL;
+#endif
+    const char *modbus_link = NULL;
+    int i;
+
+    for (i = 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "-l"))
+            level = atoi(argv[i + 1]);
+#ifdef CONFIG_TRACE
+        else if (!strcmp(argv[i], "-t"))
+            trace_path = argv[i + 1];
+#endif
+        else if (!strcmp(argv[i], "-m"))
+            modbus_link = argv[i + 1];
+        else if (!strcmp(argv[i], "-p"))
+        {
+            probe_en = true;
+            probe_z = atof(argv[i + 1]);
+        }
+    }
+    log_init(level);
+#ifdef CONFIG_TRACE
+    trace_init(trace_path);
+#endif
+    trace_thread("main");
+    modbus_emu_init(modbus_link);
+
     int sock = create_control(port);
     if (sock <= 0)
     {
-        printf("Error opening\n");
+        log_error("Error opening");
+        log_shutdown();
         return 0;
     }
 
-    printf("Listening control on :%i\n", port);
+    log_info("Listening control on :%i", port);
     pthread_mutex_init(&mutex, NULL);
+    sem_init(&events_sem, 0, 0);
 
     while (true)
     {
         fd = accept(sock, NULL, NULL);
         run = true;
-        printf("Connect from client\n");
+        log_info("Connect from client");
 
 	output_control_set_fd(fd);
         output_shell_set_fd(0);
@@ -279,6 +361,7 @@ int main(int argc, const char **argv)
 
         test_init();
         init_steppers();
+        planner_set_events_notify(events_notify);
 
         pthread_create(&tid_rcv, NULL, receive, &fd);
         usleep(100000);
@@ -289,15 +372,25 @@ int main(int argc, const char **argv)
 
         while (run)
         {
+            TRACE_BEGIN("mutex_wait");
             pthread_mutex_lock(&mutex);
+            TRACE_END("mutex_wait");
             planner_pre_calculate();
-            pthread_mutex_unlock(&mutex);
             planner_report_states();
-            usleep(1000);
+            pthread_mutex_unlock(&mutex);
+            wait_events(1000);
         }
 
         close(fd);
+        uint32_t dropped = log_dropped();
+        if (dropped > 0)
+            log_warning("%u log messages dropped", (unsigned)dropped);
+        log_flush();
+        TRACE_DUMP();
+        trace_reset();
     }
     pthread_mutex_destroy(&mutex);
+    modbus_emu_shutdown();
+    log_shutdown();
     return 0;
 }
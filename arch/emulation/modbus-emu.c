@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <master.h>
+
+#include "log.h"
+#include "trace-emu.h"
+#include "modbus-emu.h"
+
+/*
+ * Modbus UART is emulated by pty. Thread of UART works as interrupts
+ * of real UART: it sends queued frame, receives bytes, and ticks
+ * master every character time. Writes from moves use lock-free motion
+ * queue of master, as from steppers interrupt, so tick thread never waits.
+ */
+
+#define CHAR_US (11 * 1000000 / MODBUS_EMU_BAUDRATE)
+
+static int ptm = -1;
+static const char *pty_link;
+static volatile bool running;
+static volatile bool tx_started;
+static pthread_t tid_modbus;
+static pthread_mutex_t modbus_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void start_tx(void)
+{
+    tx_started = true;
+}
+
+static void uart_tx(void)
+{
+    uint8_t buf[256];
+    size_t len = 0;
+    int c;
+    while ((c = modbus_master_tx_byte()) >= 0 && len < sizeof(buf))
+        buf[len++] = c;
+    if (write(ptm, buf, len) != (ssize_t)len)
+        log_warning("Modbus write failed");
+
+    /* commands aren't blocked while frame is going out */
+    pthread_mutex_unlock(&modbus_mutex);
+    usleep(len * CHAR_US);
+    pthread_mutex_lock(&modbus_mutex);
+    modbus_master_tx_done();
+}
+
+static void *modbus_thread(void *arg)
+{
+    trace_thread("modbus");
+    while (running)
+    {
+        uint8_t buf[64];
+        ssize_t i, n;
+
+        pthread_mutex_lock(&modbus_mutex);
+        n = read(ptm, buf, sizeof(buf));
+        for (i = 0; i < n; i++)
+            modbus_master_rx_byte(buf[i]);
+        modbus_master_char_tick();
+        if (tx_started)
+        {
+            tx_started = false;
+            uart_tx();
+        }
+        pthread_mutex_unlock(&modbus_mutex);
+        usleep(CHAR_US);
+    }
+    return NULL;
+}
+
+int modbus_emu_init(const char *link)
+{
+    struct termios tio;
+
+    ptm = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (ptm < 0 || grantpt(ptm) < 0 || unlockpt(ptm) < 0)
+    {
+        log_error("Can not open modbus pty");
+        return -1;
+    }
+    tcgetattr(ptm, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(ptm, TCSANOW, &tio);
+
+    const char *name = ptsname(ptm);
+    if (link != NULL)
+    {
+        unlink(link);
+        if (symlink(name, link) < 0)
+            log_warning("Can not link %s to %s", link, name);
+        pty_link = link;
+    }
+    log_info("Modbus on %s", name);
+
+    modbus_master_init(start_tx, CHAR_US);
+    running = true;
+    pthread_create(&tid_modbus, NULL, modbus_thread, NULL);
+    return 0;
+}
+
+bool modbus_emu_command(const char *line, size_t len, void (*reply)(const char *msg, ssize_t len))
+{
+    pthread_mutex_lock(&modbus_mutex);
+    bool res = modbus_master_command(line, len, reply);
+    pthread_mutex_unlock(&modbus_mutex);
+    return res;
+}
+
+void modbus_emu_write(int device, int reg, int value)
+{
+    modbus_master_write_motion(device, reg, value);
+}
+
+void modbus_emu_shutdown(void)
+{
+    if (ptm < 0)
+        return;
+    running = false;
+    pthread_join(tid_modbus, NULL);
+    if (pty_link)
+        unlink(pty_link);
+    close(ptm);
+    ptm = -1;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <unistd.h>
+#include <stdbool.h>
+
+#define MODBUS_EMU_BAUDRATE 9600
+
+#ifdef CONFIG_MODBUS_MASTER
+
+// open pty for modbus, link - path of symlink to slave side, or NULL
+int modbus_emu_init(const char *link);
+// execute modbus text command, false if line is not modbus command
+bool modbus_emu_command(const char *line, size_t len, void (*reply)(const char *msg, ssize_t len));
+// queue modbus write from planner
+void modbus_emu_write(int device, int reg, int value);
+void modbus_emu_shutdown(void);
+
+#else
+
+#define modbus_emu_write NULL
+
+#define modbus_emu_init(link) (0)
+#define modbus_emu_command(line, len, reply) (false)
+#define modbus_emu_shutdown() do {} while (0)
+
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <trace/trace.h>
+
+#define TRACE_THREADS 8
+#define TRACE_EVENTS  32768
+
+#ifdef CONFIG_TRACE
+
+void trace_init(const char *path);
+void trace_thread(const char *name);
+void trace_reset(void);
+
+#else
+
+#define trace_init(path) do {} while (0)
+#define trace_thread(name) do {} while (0)
+#define trace_reset() do {} while (0)
+
+#endif
@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <trace/trace.h>
+
+#include "log.h"
+#include "trace-emu.h"
+
+/*
+ * Spans are recorded to preallocated per-thread buffers and dumped
+ * in Chrome trace-event format, which can be opened by chrome://tracing
+ * or ui.perfetto.dev. Tick threads are created for every move, so
+ * threads register buffers by role name and all tick threads share one.
+ */
+
+struct trace_event {
+    const char *_Atomic name;
+    char phase;
+    uint64_t ts;
+};
+
+struct trace_buffer {
+    const char *name;
+    atomic_uint len;
+    struct trace_event events[TRACE_EVENTS];
+};
+
+static struct trace_buffer buffers[TRACE_THREADS];
+static atomic_int nbuffers;
+static pthread_mutex_t register_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct trace_buffer *thread_buffer;
+
+static struct timespec start_ts;
+static const char *trace_path = "trace.json";
+
+static uint64_t trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - start_ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000 - start_ts.tv_nsec / 1000;
+}
+
+void trace_init(const char *path)
+{
+    if (path != NULL)
+        trace_path = path;
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+}
+
+void trace_thread(const char *name)
+{
+    int i, n;
+    pthread_mutex_lock(&register_mutex);
+    n = atomic_load(&nbuffers);
+    for (i = 0; i < n; i++)
+    {
+        if (!strcmp(buffers[i].name, name))
+            break;
+    }
+    if (i == n)
+    {
+        if (n == TRACE_THREADS)
+        {
+            pthread_mutex_unlock(&register_mutex);
+            thread_buffer = NULL;
+            return;
+        }
+        buffers[n].name = name;
+        atomic_store(&nbuffers, n + 1);
+    }
+    thread_buffer = &buffers[i];
+    pthread_mutex_unlock(&register_mutex);
+}
+
+static void trace_event(const char *name, char phase)
+{
+    struct trace_buffer *buf = thread_buffer;
+    if (buf == NULL)
+        return;
+
+    unsigned id = atomic_fetch_add_explicit(&buf->len, 1, memory_order_relaxed);
+    if (id >= TRACE_EVENTS)
+        return;
+
+    struct trace_event *ev = &buf->events[id];
+    ev->phase = phase;
+    ev->ts = trace_now();
+    atomic_store_explicit(&ev->name, name, memory_order_release);
+}
+
+void trace_begin(const char *name)
+{
+    trace_event(name, 'B');
+}
+
+void trace_end(const char *name)
+{
+    trace_event(name, 'E');
+}
+
+void trace_dump(void)
+{
+    int i, n = atomic_load(&nbuffers);
+    bool first = true;
+    FILE *f = fopen(trace_path, "w");
+    if (f == NULL)
+    {
+        log_error("Can not open trace file %s", trace_path);
+        return;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (i = 0; i < n; i++)
+    {
+        struct trace_buffer *buf = &buffers[i];
+        unsigned j, len = atomic_load(&buf->len);
+        if (len > TRACE_EVENTS)
+            len = TRACE_EVENTS;
+
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", i + 1, buf->name);
+        first = false;
+
+        for (j = 0; j < len; j++)
+        {
+            struct trace_event *ev = &buf->events[j];
+            const char *name = atomic_load_explicit(&ev->name, memory_order_acquire);
+            if (name == NULL)
+                continue;
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%i}",
+                    name, ev->phase, (unsigned long long)ev->ts, i + 1);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    log_info("Trace written to %s", trace_path);
+}
+
+void trace_reset(void)
+{
+    int i, n = atomic_load(&nbuffers);
+    for (i = 0; i < n; i++)
+    {
+        unsigned j;
+        for (j = 0; j < TRACE_EVENTS; j++)
+            atomic_store(&buffers[i].events[j].name, NULL);
+        atomic_store(&buffers[i].len, 0);
+    }
+}
@@ -1,4 +1,28 @@
 #pragma once
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <util/atomic.h>
+
 typedef long int ssize_t;
 
+/* avr has no atomic instructions, so interrupts are disabled instead */
+static inline bool avr_cas_u8(volatile uint8_t *ptr, uint8_t *expected, uint8_t desired)
+{
+    bool res = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (*ptr == *expected)
+        {
+            *ptr = desired;
+            res = true;
+        }
+        else
+        {
+            *expected = *ptr;
+        }
+    }
+    return res;
+}
+
+#define ATOMIC_CAS_U8(ptr, expected, desired) avr_cas_u8((ptr), (expected), (desired))
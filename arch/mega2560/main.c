@@ -16,7 +16,7 @@
 #ifdef CONFIG_LIBCORE
 static void init_steppers(void)
 {
-    gpio_definition gd;
+    gpio_definition gd = {};
 
     steppers_definition sd = {};
     steppers_config(&sd, &gd);
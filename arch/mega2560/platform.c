@@ -13,7 +13,7 @@
 #include "uart.h"
 #endif
 
-#ifdef CONFIG_LIBMODBUS
+#if defined(CONFIG_LIBMODBUS) && !defined(CONFIG_MODBUS_MASTER)
 static void modbus_uart_send(const uint8_t *data, size_t len)
 {
     uart_send_modbus(data, len);
@@ -8,6 +8,10 @@
 #include "config.h"
 #include "steppers.h"
 
+#ifdef CONFIG_MODBUS_MASTER
+#include <master.h>
+#endif
+
 #define PSC 64
 #define FTIMER (F_CPU / PSC)
 #define TIMEOUT_TIMER_STEP 1000UL
@@ -233,6 +237,15 @@ static void set_gpio(int id, int on)
     }
 }
 
+#ifdef CONFIG_MODBUS_MASTER
+static void modbus_write(int device, int reg, int value)
+{
+    modbus_master_write_motion(device, reg, value);
+}
+#else
+#define modbus_write NULL
+#endif
+
 static cnc_endstops get_stops(void)
 {
     cnc_endstops stops = {
@@ -262,5 +275,7 @@ void steppers_config(steppers_definition *sd, gpio_definition *gd)
     sd->line_finished  = line_finished;
     sd->line_error     = line_error;
     gd->set_gpio       = set_gpio;
+    gd->modbus_write   = modbus_write;
+    gd->set_pwm        = NULL;
 }
 
@@ -9,6 +9,10 @@
 #include <stdbool.h>
 #include <shell.h>
 
+#ifdef CONFIG_MODBUS_MASTER
+#include <master.h>
+#endif
+
 #define UDR(x)    CONCAT2(UDR, x)
 #define UCSRA(x)  CONCAT3(UCSR, x, A)
 #define UCSRB(x)  CONCAT3(UCSR, x, B)
@@ -27,10 +31,67 @@
 
 #define RXCIE(x)  CONCAT2(RXCIE, x)
 #define TXCIE(x)  CONCAT2(TXCIE, x)
+#define UDRIE(x)  CONCAT2(UDRIE, x)
 
-#define USART_RX_vect(x) CONCAT3(USART, x, _RX_vect)
+/* vector names are pasted without parentheses, ISR() declares function with them */
+#define VECT3(a, b, c)      a##b##c
+#define USART_RX_vect(x)    VECT3(USART, x, _RX_vect)
+#define USART_TX_vect(x)    VECT3(USART, x, _TX_vect)
+#define USART_UDRE_vect(x)  VECT3(USART, x, _UDRE_vect)
 
-#ifdef CONFIG_LIBMODBUS
+#ifdef CONFIG_MODBUS_MASTER
+
+/* 1 character of modbus RTU is 11 bits, timer 3 ticks every character */
+#define MODBUS_TIMER_PSC 64
+#define MODBUS_CHAR_TICKS (F_CPU / MODBUS_TIMER_PSC * 11 / MODBUS_UART_BAUDRATE)
+
+static void modbus_start_tx(void)
+{
+    /* RTS */
+    PORT(MODBUS_UART_RTS_PORT) &= ~(1 << MODBUS_UART_RTS_PIN);
+    UCSRA(MODBUS_UART_PORT) |= 1 << TXC(MODBUS_UART_PORT);
+    UCSRB(MODBUS_UART_PORT) |= 1 << UDRIE(MODBUS_UART_PORT);
+}
+
+ISR(USART_UDRE_vect(MODBUS_UART_PORT))
+{
+    int c = modbus_master_tx_byte();
+    if (c < 0)
+    {
+        UCSRB(MODBUS_UART_PORT) &= ~(1 << UDRIE(MODBUS_UART_PORT));
+        UCSRB(MODBUS_UART_PORT) |= 1 << TXCIE(MODBUS_UART_PORT);
+        return;
+    }
+    UDR(MODBUS_UART_PORT) = c;
+}
+
+ISR(USART_TX_vect(MODBUS_UART_PORT))
+{
+    UCSRB(MODBUS_UART_PORT) &= ~(1 << TXCIE(MODBUS_UART_PORT));
+    PORT(MODBUS_UART_RTS_PORT) |= 1 << MODBUS_UART_RTS_PIN;
+    modbus_master_tx_done();
+}
+
+ISR(USART_RX_vect(MODBUS_UART_PORT))
+{
+    uint8_t c = UDR(MODBUS_UART_PORT);
+    modbus_master_rx_byte(c);
+}
+
+ISR(TIMER3_COMPA_vect)
+{
+    modbus_master_char_tick();
+}
+
+static void modbus_timer_setup(void)
+{
+    TCCR3A = 0;
+    TCCR3B = 1 << WGM32 | 1 << CS31 | 1 << CS30; // CTC, F_CPU / 64
+    OCR3A = MODBUS_CHAR_TICKS - 1;
+    TIMSK3 |= 1 << OCIE3A;
+}
+
+#elif defined(CONFIG_LIBMODBUS)
 void uart_send_modbus(const uint8_t *data, size_t len)
 {
     /* RTS */
@@ -73,17 +134,12 @@ void uart_rxie_enable(bool en)
         UCSRB(CONTROL_UART_PORT) &= ~(1 << RXCIE(CONTROL_UART_PORT));
 }
 
-ISR(USART0_RX_vect)
+ISR(USART_RX_vect(CONTROL_UART_PORT))
 {
     uint8_t c = UDR(CONTROL_UART_PORT);
+    shell_data_received(&c, 1);
     if (c == '\n' || c == '\r')
-    {
         uart_message_received = true;
-    }
-    else
-    {
-        shell_data_received(&c, 1);
-    }
 }
 
 #endif
@@ -94,7 +150,11 @@ void uart_setup(void)
     uint16_t ubrr;
 #ifdef CONFIG_LIBMODBUS
     UCSRA(MODBUS_UART_PORT) = 0;
+#ifdef CONFIG_MODBUS_MASTER
+    UCSRB(MODBUS_UART_PORT) = (1 << TXEN(MODBUS_UART_PORT)) | (1 << RXEN(MODBUS_UART_PORT)) | (1 << RXCIE(MODBUS_UART_PORT));
+#else
     UCSRB(MODBUS_UART_PORT) = (1 << TXEN(MODBUS_UART_PORT));
+#endif
 //    UCSRC(MODBUS_UART_PORT) = (1 << UCSZ1(MODBUS_UART_PORT)) | (1 << UCSZ0(MODBUS_UART_PORT));
 
     ubrr = F_CPU / 16 / MODBUS_UART_BAUDRATE - 1;
@@ -102,6 +162,11 @@ void uart_setup(void)
     UBRRH(MODBUS_UART_PORT) = (ubrr >> 8) & 0xFF;
 #endif
 
+#ifdef CONFIG_MODBUS_MASTER
+    modbus_master_init(modbus_start_tx, 11 * 1000000UL / MODBUS_UART_BAUDRATE);
+    modbus_timer_setup();
+#endif
+
 #ifdef CONFIG_BOARD_MEGA2560_CONTROL_UART
     UCSRA(CONTROL_UART_PORT) = 0;
     UCSRB(CONTROL_UART_PORT) = (1 << TXEN(CONTROL_UART_PORT)) | (1 << RXEN(CONTROL_UART_PORT)) | (1 << RXCIE(CONTROL_UART_PORT));
@@ -6,7 +6,7 @@
 
 void uart_setup(void);
 
-#ifdef CONFIG_LIBMODBUS
+#if defined(CONFIG_LIBMODBUS) && !defined(CONFIG_MODBUS_MASTER)
 void uart_send_modbus(const uint8_t *buf, size_t len);
 #endif
 
@@ -281,5 +281,7 @@ void steppers_config(steppers_definition *sd, gpio_definition *gd)
     sd->line_finished  = line_finished;
     sd->line_error     = line_error;
     gd->set_gpio       = set_gpio;
+    gd->modbus_write   = NULL;
+    gd->set_pwm        = NULL;
 }
 
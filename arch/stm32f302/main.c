@@ -27,22 +27,40 @@ static xSemaphoreHandle shellMutex = NULL;
 #ifdef CONFIG_LIBCORE
 static void init_steppers(void)
 {
-	gpio_definition gd;
+	gpio_definition gd = {};
 
 	steppers_definition sd = {};
 	steppers_config(&sd, &gd);
 	init_control(&sd, &gd);
 }
 
+static xSemaphoreHandle eventsSem = NULL;
+
+/* moves notify from step timer ISR, and tool or modbus records are passed from task too */
+static void events_notify(void)
+{
+	BaseType_t woken = pdFALSE;
+	if (!xPortIsInsideInterrupt())
+	{
+		xSemaphoreGive(eventsSem);
+		return;
+	}
+	xSemaphoreGiveFromISR(eventsSem, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+
 static void preCalculateTask(void *args)
 {
 	while (true)
 	{
+		/* wake up on events of moves, queued commands are pre-calculated every tick */
+		xSemaphoreTake(eventsSem, 1);
+
+		/* planner is changed by commands too, so it is used under the same mutex */
 		xSemaphoreTake(shellMutex, portMAX_DELAY);
 		planner_report_states();
-		xSemaphoreGive(shellMutex);
-
 		planner_pre_calculate();
+		xSemaphoreGive(shellMutex);
 	}
 }
 #endif
@@ -133,7 +151,9 @@ int main(void)
 	hardware_setup();
 
 #ifdef CONFIG_LIBCORE
+	eventsSem = xSemaphoreCreateBinary();
 	init_steppers();
+	planner_set_events_notify(events_notify);
 	planner_lock();
 	moves_reset();
 #endif
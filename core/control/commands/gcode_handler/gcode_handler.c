@@ -1,4 +1,3 @@
-#include <stdio.h>
 #include <stddef.h>
 #include <string.h>
 #include <unistd.h>
@@ -11,6 +10,23 @@
 #include <control/commands/status/print_status.h>
 #include <control/planner/planner.h>
 #include <control/system.h>
+#include <output/format.h>
+#include <trace/trace.h>
+
+#define POLYLINE_MAX_BYTES 256
+#define RASTER_MAX_BYTES 256
+
+static void send_unknown_command(int nid, char type, int code)
+{
+    char buf[40];
+    char *end = buf + sizeof(buf) - 1;
+    char *p = fmt_str(buf, end, "unknown command ");
+    if (p < end)
+        *p++ = type;
+    p = fmt_int(p, end, code);
+    *p = 0;
+    send_error(nid, buf);
+}
 
 static int handle_g_command(gcode_frame_t *frame)
 {
@@ -88,6 +104,12 @@ static int handle_g_command(gcode_frame_t *frame)
                 send_error(nid, "system is locked");
                 return res;
             }
+            else if (res == -E_LIMITS)
+            {
+                send_error(nid, "out of soft limits");
+                planner_lock();
+                return res;
+            }
             else
             {
                 send_error(nid, "problem with planning line");
@@ -180,6 +202,12 @@ static int handle_g_command(gcode_frame_t *frame)
                 send_error(nid, "system is locked");
                 return res;
             }
+            else if (res == -E_LIMITS)
+            {
+                send_error(nid, "out of soft limits");
+                planner_lock();
+                return res;
+            }
             else
             {
                 send_error(nid, "problem with planning arc");
@@ -188,11 +216,362 @@ static int handle_g_command(gcode_frame_t *frame)
             }
             break;
         }
+        case 5: {
+            int i;
+            double f = 0, feed0 = 0, feed1 = 0;
+            double acc = 0;
+            int32_t p1[3] = {0, 0, 0};
+            int32_t p2[3] = {0, 0, 0};
+            int32_t x[3] = {0, 0, 0};
+            for (i = 1; i < ncmds; i++) {
+                switch (cmds[i].type) {
+                case 'X':
+                    x[0] = cmds[i].val_i;
+                    break;
+                case 'Y':
+                    x[1] = cmds[i].val_i;
+                    break;
+                case 'Z':
+                    x[2] = cmds[i].val_i;
+                    break;
+                case 'I':
+                    p1[0] = cmds[i].val_i;
+                    break;
+                case 'J':
+                    p1[1] = cmds[i].val_i;
+                    break;
+                case 'K':
+                    p1[2] = cmds[i].val_i;
+                    break;
+                case 'U':
+                    p2[0] = cmds[i].val_i;
+                    break;
+                case 'V':
+                    p2[1] = cmds[i].val_i;
+                    break;
+                case 'W':
+                    p2[2] = cmds[i].val_i;
+                    break;
+                case 'F':
+                    f = cmds[i].val_f;
+                    break;
+                case 'P':
+                    feed0 = cmds[i].val_f;
+                    break;
+                case 'L':
+                    feed1 = cmds[i].val_f;
+                    break;
+                case 'T':
+                    acc = cmds[i].val_f;
+                    break;
+                }
+            }
+            int res = planner_spline_to(p1, p2, x, f, feed0, feed1, acc, nid);
+            if (res >= 0)
+            {
+                return -E_OK;
+            }
+            else if (res == -E_NOMEM)
+            {
+                send_error(nid, "no space in buffer");
+                planner_lock();
+                return res;
+            }
+            else if (res == -E_LOCKED)
+            {
+                send_error(nid, "system is locked");
+                return res;
+            }
+            else if (res == -E_LIMITS)
+            {
+                send_error(nid, "out of soft limits");
+                planner_lock();
+                return res;
+            }
+            else if (res == -E_INCORRECT)
+            {
+                send_error(nid, "spline is too long");
+                planner_lock();
+                return res;
+            }
+            else
+            {
+                send_error(nid, "problem with planning spline");
+                planner_lock();
+                return res;
+            }
+            break;
+        }
+        case 6: {
+            int i;
+            double f = 0, feed0 = 0, feed1 = 0;
+            double acc = 0;
+            uint8_t data[POLYLINE_MAX_BYTES];
+            int len = 0;
+            for (i = 1; i < ncmds; i++) {
+                switch (cmds[i].type) {
+                case 'V':
+                    len = gcode_decode_hex(&cmds[i], data, sizeof(data));
+                    break;
+                case 'F':
+                    f = cmds[i].val_f;
+                    break;
+                case 'P':
+                    feed0 = cmds[i].val_f;
+                    break;
+                case 'L':
+                    feed1 = cmds[i].val_f;
+                    break;
+                case 'T':
+                    acc = cmds[i].val_f;
+                    break;
+                }
+            }
+            int res = len;
+            if (res >= 0)
+                res = planner_polyline_to(data, len, f, feed0, feed1, acc, nid);
+            if (res >= 0)
+            {
+                return -E_OK;
+            }
+            else if (res == -E_NOMEM)
+            {
+                send_error(nid, "no space in buffer");
+                planner_lock();
+                return res;
+            }
+            else if (res == -E_LOCKED)
+            {
+                send_error(nid, "system is locked");
+                return res;
+            }
+            else if (res == -E_LIMITS)
+            {
+                send_error(nid, "out of soft limits");
+                planner_lock();
+                return res;
+            }
+            else
+            {
+                send_error(nid, "problem with planning polyline");
+                planner_lock();
+                return res;
+            }
+            break;
+        }
+        case 28: {
+            int i;
+            int32_t distance[3] = {0, 0, 0};
+            int32_t backoff = 0;
+            double f = 0, latch = 0;
+            double acc = 0;
+            for (i = 1; i < ncmds; i++) {
+                switch (cmds[i].type) {
+                case 'X':
+                    distance[0] = cmds[i].val_i;
+                    break;
+                case 'Y':
+                    distance[1] = cmds[i].val_i;
+                    break;
+                case 'Z':
+                    distance[2] = cmds[i].val_i;
+                    break;
+                case 'B':
+                    backoff = cmds[i].val_i;
+                    break;
+                case 'F':
+                    f = cmds[i].val_f;
+                    break;
+                case 'L':
+                    latch = cmds[i].val_f;
+                    break;
+                case 'T':
+                    acc = cmds[i].val_f;
+                    break;
+                }
+            }
+            int res = planner_homing(distance, backoff, f, latch, acc, nid);
+            if (res >= 0)
+            {
+                return -E_OK;
+            }
+            else if (res == -E_NOMEM)
+            {
+                send_error(nid, "no space in buffer");
+                planner_lock();
+                return res;
+            }
+            else if (res == -E_LOCKED)
+            {
+                send_error(nid, "system is locked");
+                return res;
+            }
+            else
+            {
+                send_error(nid, "problem with planning homing");
+                planner_lock();
+                return res;
+            }
+        }
+        case 29: {
+            int i;
+            int32_t offset[2] = {0, 0};
+            int32_t pitch[2] = {0, 0};
+            int count[2] = {1, 1};
+            int32_t depth = 0, retract = 0;
+            int repeats = 1;
+            double f = 0, travel = 0;
+            double acc = 0;
+            for (i = 1; i < ncmds; i++) {
+                switch (cmds[i].type) {
+                case 'X':
+                    offset[0] = cmds[i].val_i;
+                    break;
+                case 'Y':
+                    offset[1] = cmds[i].val_i;
+                    break;
+                case 'I':
+                    pitch[0] = cmds[i].val_i;
+                    break;
+                case 'J':
+                    pitch[1] = cmds[i].val_i;
+                    break;
+                case 'A':
+                    count[0] = cmds[i].val_i;
+                    break;
+                case 'B':
+                    count[1] = cmds[i].val_i;
+                    break;
+                case 'Z':
+                    depth = cmds[i].val_i;
+                    break;
+                case 'R':
+                    retract = cmds[i].val_i;
+                    break;
+                case 'K':
+                    repeats = cmds[i].val_i;
+                    break;
+                case 'F':
+                    f = cmds[i].val_f;
+                    break;
+                case 'Q':
+                    travel = cmds[i].val_f;
+                    break;
+                case 'T':
+                    acc = cmds[i].val_f;
+                    break;
+                }
+            }
+            int res = planner_probe_grid(offset, pitch, count, depth, retract, repeats, f, travel, acc, nid);
+            if (res >= 0)
+            {
+                return -E_OK;
+            }
+            else if (res == -E_NOMEM)
+            {
+                send_error(nid, "no space in buffer");
+                planner_lock();
+                return res;
+            }
+            else if (res == -E_LOCKED)
+            {
+                send_error(nid, "system is locked");
+                return res;
+            }
+            else if (res == -E_LIMITS)
+            {
+                send_error(nid, "out of soft limits");
+                planner_lock();
+                return res;
+            }
+            else
+            {
+                send_error(nid, "problem with planning probing");
+                planner_lock();
+                return res;
+            }
+            break;
+        }
+        case 7: {
+            int i;
+            double f = 0, feed0 = 0, feed1 = 0;
+            double acc = 0;
+            int32_t x[3] = {0, 0, 0};
+            int bits = 8, pitch = 1, tool = 0;
+            uint8_t data[RASTER_MAX_BYTES];
+            int len = 0;
+            for (i = 1; i < ncmds; i++) {
+                switch (cmds[i].type) {
+                case 'X':
+                    x[0] = cmds[i].val_i;
+                    break;
+                case 'Y':
+                    x[1] = cmds[i].val_i;
+                    break;
+                case 'Z':
+                    x[2] = cmds[i].val_i;
+                    break;
+                case 'V':
+                    len = gcode_decode_hex(&cmds[i], data, sizeof(data));
+                    break;
+                case 'B':
+                    bits = cmds[i].val_i;
+                    break;
+                case 'S':
+                    pitch = cmds[i].val_i;
+                    break;
+                case 'D':
+                    tool = cmds[i].val_i;
+                    break;
+                case 'F':
+                    f = cmds[i].val_f;
+                    break;
+                case 'P':
+                    feed0 = cmds[i].val_f;
+                    break;
+                case 'L':
+                    feed1 = cmds[i].val_f;
+                    break;
+                case 'T':
+                    acc = cmds[i].val_f;
+                    break;
+                }
+            }
+            int res = len;
+            if (res >= 0)
+                res = planner_raster_to(x, data, len, bits, pitch, tool, f, feed0, feed1, acc, nid);
+            if (res >= 0)
+            {
+                return -E_OK;
+            }
+            else if (res == -E_NOMEM)
+            {
+                send_error(nid, "no space in buffer");
+                planner_lock();
+                return res;
+            }
+            else if (res == -E_LOCKED)
+            {
+                send_error(nid, "system is locked");
+                return res;
+            }
+            else if (res == -E_LIMITS)
+            {
+                send_error(nid, "out of soft limits");
+                planner_lock();
+                return res;
+            }
+            else
+            {
+                send_error(nid, "problem with planning raster");
+                planner_lock();
+                return res;
+            }
+            break;
+        }
         default:
         {
-            char buf[60];
-            snprintf(buf, 60, "unknown command G%i", cmds[0].val_i);
-            send_error(nid, buf);
+            send_unknown_command(nid, 'G', cmds[0].val_i);
             planner_lock();
             return -E_INCORRECT;
         }
@@ -201,19 +580,57 @@ static int handle_g_command(gcode_frame_t *frame)
     case 'M':
         switch (cmds[0].val_i) {
         case 3:
+        case 4:
         case 5:
         {
             int tool = 0;
-            int on = (cmds[0].val_i == 3);
+            int on = (cmds[0].val_i != 5);
+            int step = -1;
+            double power = 0;
 	    int i;
             for (i = 1; i < ncmds; i++) {
                 switch (cmds[i].type) {
                 case 'D':
                     tool = cmds[i].val_i;
 		    break;
+                case 'S':
+                    step = cmds[i].val_i;
+                    break;
+                case 'P':
+                    power = cmds[i].val_f;
+                    break;
                 }
 	    }
-            int res = planner_tool(tool, on, nid);
+            if (cmds[0].val_i == 4)
+            {
+                /* dynamic power: M4 is always queued */
+                step = -1;
+                if (power <= 0)
+                    power = 1;
+            }
+            else
+            {
+                power = 0;
+            }
+            if (step >= 0)
+            {
+                /* switch inside of next line or arc */
+                int res = planner_tool_event(tool, on, step);
+                if (res >= 0)
+                {
+                    send_ok(nid);
+                    return -E_OK;
+                }
+                else if (res == -E_LOCKED)
+                {
+                    send_error(nid, "system is locked");
+                    return res;
+                }
+                send_error(nid, "too many tool events");
+                planner_lock();
+                return res;
+            }
+            int res = planner_tool(tool, on, power, nid);
             if (res >= 0)
             {
                 return -E_OK;
@@ -238,6 +655,60 @@ static int handle_g_command(gcode_frame_t *frame)
 
             return -E_OK;
 	}
+        case 160:
+        {
+            int device = -1, reg = -1, value = -1;
+            int i;
+            for (i = 1; i < ncmds; i++) {
+                switch (cmds[i].type) {
+                case 'D':
+                    device = cmds[i].val_i;
+                    break;
+                case 'R':
+                    reg = cmds[i].val_i;
+                    break;
+                case 'V':
+                    value = cmds[i].val_i;
+                    break;
+                }
+            }
+            if (device < 0 || device > 0xFF || reg < 0 || reg > 0xFFFF || value < 0 || value > 0xFFFF)
+            {
+                send_error(nid, "incorrect modbus write");
+                planner_lock();
+                return -E_INCORRECT;
+            }
+            int res = planner_modbus_write(device, reg, value, nid);
+            if (res >= 0)
+            {
+                return -E_OK;
+            }
+            else if (res == -E_NOMEM)
+            {
+                send_error(nid, "no space in buffer");
+                planner_lock();
+                return res;
+            }
+            else if (res == -E_LOCKED)
+            {
+                send_error(nid, "system is locked");
+                return res;
+            }
+            else
+            {
+                send_error(nid, "problem with planning modbus write");
+                planner_lock();
+                return res;
+            }
+        }
+        case 24:
+            moves_set_hold(false);
+            send_ok(nid);
+            return -E_OK;
+        case 25:
+            moves_set_hold(true);
+            send_ok(nid);
+            return -E_OK;
         case 100: {
             int i;
             steppers_definition def = moves_common_def;
@@ -277,6 +748,62 @@ static int handle_g_command(gcode_frame_t *frame)
             send_ok(nid);
             return -E_OK;
         }
+        case 101: {
+            int i;
+            double angle = 0, deviation = 0;
+            for (i = 1; i < ncmds; i++) {
+                switch (cmds[i].type) {
+                case 'A':
+                    angle = cmds[i].val_f;
+                    break;
+                case 'D':
+                    deviation = cmds[i].val_f;
+                    break;
+                }
+            }
+            planner_set_merge(angle, deviation);
+            send_ok(nid);
+            return -E_OK;
+        }
+        case 102: {
+            int i;
+            bool enable = false;
+            int32_t lo[3] = {0, 0, 0};
+            int32_t hi[3] = {0, 0, 0};
+            for (i = 1; i < ncmds; i++) {
+                switch (cmds[i].type) {
+                case 'X':
+                    lo[0] = cmds[i].val_i;
+                    break;
+                case 'Y':
+                    lo[1] = cmds[i].val_i;
+                    break;
+                case 'Z':
+                    lo[2] = cmds[i].val_i;
+                    break;
+                case 'I':
+                    hi[0] = cmds[i].val_i;
+                    break;
+                case 'J':
+                    hi[1] = cmds[i].val_i;
+                    break;
+                case 'K':
+                    hi[2] = cmds[i].val_i;
+                    break;
+                default:
+                    continue;
+                }
+                enable = true;
+            }
+            if (enable && (lo[0] > hi[0] || lo[1] > hi[1] || lo[2] > hi[2]))
+            {
+                send_error(nid, "incorrect soft limits");
+                return -E_INCORRECT;
+            }
+            planner_set_soft_limits(enable, lo, hi);
+            send_ok(nid);
+            return -E_OK;
+        }
         case 114:
             send_queued(nid);
             print_position(nid);
@@ -285,6 +812,22 @@ static int handle_g_command(gcode_frame_t *frame)
             send_queued(nid);
             print_endstops(nid);
             return -E_OK;
+        case 220: {
+            int i;
+            int percent = 100;
+            for (i = 1; i < ncmds; i++) {
+                if (cmds[i].type == 'S')
+                    percent = cmds[i].val_i;
+            }
+            if (percent < 1 || percent > 1000)
+            {
+                send_error(nid, "incorrect feed override");
+                return -E_INCORRECT;
+            }
+            moves_set_feed_override(percent / 100.0);
+            send_ok(nid);
+            return -E_OK;
+        }
         case 800:
             planner_unlock();
             send_ok(nid);
@@ -301,6 +844,10 @@ static int handle_g_command(gcode_frame_t *frame)
             planner_fail_on_endstops(true);
             send_ok(nid);
             return -E_OK;
+        case 990:
+            TRACE_DUMP();
+            send_ok(nid);
+            return -E_OK;
 	case 995:
             enable_break_on_probe(false);
             send_ok(nid);
@@ -311,7 +858,7 @@ static int handle_g_command(gcode_frame_t *frame)
             return -E_OK;
         case 997: {
             int32_t x[3] = {0};
-            moves_common_set_position(x);
+            planner_set_position(x);
             send_ok(nid);
             return -E_OK;
         }
@@ -322,9 +869,7 @@ static int handle_g_command(gcode_frame_t *frame)
             return -E_OK;
         default:
         {
-            char buf[60];
-            snprintf(buf, 60, "unknown command M%i", cmds[0].val_i);
-            send_error(nid, buf);
+            send_unknown_command(nid, 'M', cmds[0].val_i);
             planner_lock();
             return -E_INCORRECT;
         }
@@ -332,9 +877,7 @@ static int handle_g_command(gcode_frame_t *frame)
         break;
     default:
     {
-        char buf[60];
-        snprintf(buf, 60, "unknown command %c%i", cmds[0].type, cmds[0].val_i);
-        send_error(nid, buf);
+        send_unknown_command(nid, cmds[0].type, cmds[0].val_i);
         planner_lock();
         return -E_INCORRECT;
     }
@@ -348,6 +891,8 @@ int execute_g_command(const unsigned char *command, ssize_t len)
     gcode_frame_t frame;
     int rc;
 
+    TRACE_SCOPE("execute_g_command");
+
     if (len < 0)
         len = strlen((const char *)command);
 
@@ -362,16 +907,16 @@ int execute_g_command(const unsigned char *command, ssize_t len)
         default:
         {
             planner_lock();
-            char buf[320] = {0};
-            snprintf(buf, sizeof(buf), "parse error: %i [", (int)len);
+            char buf[320];
+            char *end = buf + sizeof(buf) - 2;
+            char *p = fmt_str(buf, end, "parse error: ");
+            p = fmt_int(p, end, len);
+            p = fmt_str(p, end, " [");
             int i;
             for (i = 0; i < len; i++)
-            {
-                char cbuf[10] = {0};
-                sprintf(cbuf, "%02x", command[i]);
-                strcat(buf, cbuf);
-            }
-            strcat(buf, "]");
+                p = fmt_hex(p, end, command[i]);
+            *p++ = ']';
+            *p = 0;
             send_error(-1, buf);
             return rc;
         }
@@ -1,34 +1,54 @@
-#include <stdio.h>
 #include <unistd.h>
-#include <string.h>
 
 #include <control/commands/status/print_status.h>
 #include <control/ioqueue/print_events.h>
 #include <control/moves/moves.h>
 #include <control/planner/planner.h>
 #include <output/output.h>
+#include <output/format.h>
 
-#define min(a,b) ((a) < (b) ? (a) : (b))
+#define ST_COMPLETED "completed N:"
+#define ST_QUEUE     " Q:"
+#define ST_EX        " EX:"
+#define ST_EY        " EY:"
+#define ST_EZ        " EZ:"
+#define ST_EP        " EP:"
 
 void print_endstops(int nid)
 {
-    char buf[128]; 
+    char *buf, *end, *p;
+    size_t len;
+    int slots;
     send_started(nid);
-    int q = empty_slots();
     cnc_endstops stops = moves_get_endstops();
-    snprintf(buf, sizeof(buf), "completed N:%i Q:%i EX:%i EY:%i EZ:%i EP:%i", nid, q, stops.stop_x, stops.stop_y, stops.stop_z, stops.probe);
-    buf[127] = 0;
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    slots = empty_slots();
+    len = FMT_STR_LEN(ST_COMPLETED) + fmt_int_len(nid) +
+          FMT_STR_LEN(ST_QUEUE) + fmt_int_len(slots) +
+          FMT_STR_LEN(ST_EX) + fmt_int_len(stops.stop_x) +
+          FMT_STR_LEN(ST_EY) + fmt_int_len(stops.stop_y) +
+          FMT_STR_LEN(ST_EZ) + fmt_int_len(stops.stop_z) +
+          FMT_STR_LEN(ST_EP) + fmt_int_len(stops.probe);
+    buf = output_control_reserve(len);
+    if (buf == NULL)
+        return;
+    end = buf + len;
+    p = fmt_str(buf, end, ST_COMPLETED);
+    p = fmt_int(p, end, nid);
+    p = fmt_str(p, end, ST_QUEUE);
+    p = fmt_int(p, end, slots);
+    p = fmt_str(p, end, ST_EX);
+    p = fmt_int(p, end, stops.stop_x);
+    p = fmt_str(p, end, ST_EY);
+    p = fmt_int(p, end, stops.stop_y);
+    p = fmt_str(p, end, ST_EZ);
+    p = fmt_int(p, end, stops.stop_z);
+    p = fmt_str(p, end, ST_EP);
+    p = fmt_int(p, end, stops.probe);
+    output_control_commit(p - buf);
 }
 
 void print_position(int nid)
 {
-    char buf[128];
     send_started(nid);
-    int q = empty_slots();
-
-    snprintf(buf, sizeof(buf), "completed N:%i Q:%i X:%ld Y:%ld Z:%ld", nid, q, (long)position.pos[0], (long)position.pos[1], (long)position.pos[2]);
-    buf[127] = 0;
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    send_completed_with_pos(nid, position.pos);
 }
-
@@ -34,9 +34,14 @@ static void cb_send_completed_with_pos(int nid, const int32_t *pos)
     send_completed_with_pos(nid, pos);
 }
 
+static void cb_send_probed(int nid, int index, const int32_t *values, int n)
+{
+    send_probed(nid, index, values, n);
+}
+
 void init_control(steppers_definition *pd, gpio_definition *gd)
 {
-    init_planner(pd, gd, cb_send_queued, cb_send_started, cb_send_completed, cb_send_completed_with_pos, cb_send_dropped, cb_send_failed);
+    init_planner(pd, gd, cb_send_queued, cb_send_started, cb_send_completed, cb_send_completed_with_pos, cb_send_dropped, cb_send_failed, cb_send_probed);
     system_init(pd->reboot);
 }
 
@@ -1,60 +1,134 @@
-#include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 
 #include <output/output.h>
+#include <output/format.h>
 #include <control/planner/planner.h>
+#include <control/planner/probe_grid.h>
 
-#define min(a,b) ((a) < (b) ? (a) : (b))
+/* messages are reserved with their actual length, so they fit while output has place for them */
+
+#define EV_COMPLETED "completed N:"
+#define EV_PROBED    "probed N:"
+#define EV_QUEUE     " Q:"
+#define EV_X         " X:"
+#define EV_Y         " Y:"
+#define EV_Z         " Z:"
+#define EV_INDEX     " I:"
+#define EV_SEP       " "
+#define EV_COMMA     ","
+#define EV_MISSED    "x"
+
+static void send_event(const char *prefix, int nid)
+{
+    int slots = empty_slots();
+    size_t len = strlen(prefix) + fmt_int_len(nid) + FMT_STR_LEN(EV_QUEUE) + fmt_int_len(slots);
+    char *buf = output_control_reserve(len);
+    if (buf == NULL)
+        return;
+    char *end = buf + len;
+    char *p = fmt_str(buf, end, prefix);
+    p = fmt_int(p, end, nid);
+    p = fmt_str(p, end, EV_QUEUE);
+    p = fmt_int(p, end, slots);
+    output_control_commit(p - buf);
+}
+
+static void send_message(const char *prefix, int nid, const char *msg)
+{
+    size_t len = strlen(prefix) + fmt_int_len(nid) + FMT_STR_LEN(EV_SEP) + strlen(msg);
+    char *buf = output_control_reserve(len);
+    if (buf == NULL)
+        return;
+    char *end = buf + len;
+    char *p = fmt_str(buf, end, prefix);
+    p = fmt_int(p, end, nid);
+    p = fmt_str(p, end, EV_SEP);
+    p = fmt_str(p, end, msg);
+    output_control_commit(p - buf);
+}
 
 void send_queued(int nid)
 {
-    char buf[50];
-    int q = empty_slots();
-    snprintf(buf, sizeof(buf), "queued N:%i Q:%i", nid, q);
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    send_event("queued N:", nid);
 }
 
 void send_dropped(int nid)
 {
-    char buf[50];
-    int q = empty_slots();
-    snprintf(buf, sizeof(buf), "dropped N:%i Q:%i", nid, q);
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    send_event("dropped N:", nid);
 }
 
 void send_started(int nid)
 {
-    char buf[50];
-    int q = empty_slots();
-    snprintf(buf, sizeof(buf), "started N:%i Q:%i", nid, q);
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    send_event("started N:", nid);
 }
 
 void send_completed(int nid)
 {
-    char buf[50];
-    int q = empty_slots();
-    snprintf(buf, sizeof(buf), "completed N:%i Q:%i", nid, q);
-    buf[49] = 0;
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    send_event(EV_COMPLETED, nid);
 }
 
 void send_completed_with_pos(int nid, const int32_t *pos)
 {
-    char buf[50];
-    int q = empty_slots();
-    snprintf(buf, sizeof(buf), "completed N:%i Q:%i X:%ld Y:%ld Z:%ld", nid, q, (long)pos[0], (long)pos[1], (long)pos[2]);
-    buf[49] = 0;
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    int slots = empty_slots();
+    size_t len = FMT_STR_LEN(EV_COMPLETED) + fmt_int_len(nid) +
+                 FMT_STR_LEN(EV_QUEUE) + fmt_int_len(slots) +
+                 FMT_STR_LEN(EV_X) + fmt_int_len(pos[0]) +
+                 FMT_STR_LEN(EV_Y) + fmt_int_len(pos[1]) +
+                 FMT_STR_LEN(EV_Z) + fmt_int_len(pos[2]);
+    char *buf = output_control_reserve(len);
+    if (buf == NULL)
+        return;
+    char *end = buf + len;
+    char *p = fmt_str(buf, end, EV_COMPLETED);
+    p = fmt_int(p, end, nid);
+    p = fmt_str(p, end, EV_QUEUE);
+    p = fmt_int(p, end, slots);
+    p = fmt_str(p, end, EV_X);
+    p = fmt_int(p, end, pos[0]);
+    p = fmt_str(p, end, EV_Y);
+    p = fmt_int(p, end, pos[1]);
+    p = fmt_str(p, end, EV_Z);
+    p = fmt_int(p, end, pos[2]);
+    output_control_commit(p - buf);
+}
+
+// values, missed points are 'x'
+void send_probed(int nid, int index, const int32_t *values, int n)
+{
+    int i;
+    size_t len = FMT_STR_LEN(EV_PROBED) + fmt_int_len(nid) +
+                 FMT_STR_LEN(EV_INDEX) + fmt_int_len(index) + FMT_STR_LEN(EV_Z);
+    for (i = 0; i < n; i++)
+    {
+        if (i > 0)
+            len += FMT_STR_LEN(EV_COMMA);
+        len += (values[i] == PROBE_GRID_MISSED) ? FMT_STR_LEN(EV_MISSED) : fmt_int_len(values[i]);
+    }
+    char *buf = output_control_reserve(len);
+    if (buf == NULL)
+        return;
+    char *end = buf + len;
+    char *p = fmt_str(buf, end, EV_PROBED);
+    p = fmt_int(p, end, nid);
+    p = fmt_str(p, end, EV_INDEX);
+    p = fmt_int(p, end, index);
+    p = fmt_str(p, end, EV_Z);
+    for (i = 0; i < n; i++)
+    {
+        if (i > 0)
+            p = fmt_str(p, end, EV_COMMA);
+        if (values[i] == PROBE_GRID_MISSED)
+            p = fmt_str(p, end, EV_MISSED);
+        else
+            p = fmt_int(p, end, values[i]);
+    }
+    output_control_commit(p - buf);
 }
 
 void send_failed(int nid)
 {
-    char buf[50];
-    snprintf(buf, sizeof(buf), "failed N:%i move failed", nid);
-    buf[49] = 0;
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    send_message("failed N:", nid, "move failed");
 }
 
 void send_ok(int nid)
@@ -66,17 +140,10 @@ void send_ok(int nid)
 
 void send_error(int nid, const char *err)
 {
-    char buf[50];
-    snprintf(buf, sizeof(buf), "error N:%i %s", nid, err);
-    buf[49] = 0;
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    send_message("error N:", nid, err);
 }
 
 void send_warning(int nid, const char *err)
 {
-    char buf[50];
-    snprintf(buf, sizeof(buf), "warning N:%i %s", nid, err);
-    buf[49] = 0;
-    output_control_write(buf, min(strlen(buf), sizeof(buf)));
+    send_message("warning N:", nid, err);
 }
-
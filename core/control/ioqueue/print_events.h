@@ -9,6 +9,7 @@ void send_completed(int nid);
 void send_completed_with_pos(int nid, const int32_t *pos);
 void send_dropped(int nid);
 void send_failed(int nid);
+void send_probed(int nid, int index, const int32_t *values, int n);
 
 void send_ok(int nid);
 void send_error(int nid, const char *err);
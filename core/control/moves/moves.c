@@ -1,23 +1,164 @@
 #include <control/moves/moves.h>
 #include <control/moves/moves_line/line.h>
 #include <control/moves/moves_arc/arc.h>
+#include <control/moves/moves_spline/spline.h>
 
-static enum {
+static volatile enum {
     MOVE_NONE = 0,
     MOVE_LINE,
     MOVE_ARC,
+    MOVE_SPLINE,
 } current_move_type;
 
 static bool ready = true;
 
+static const tool_event *tool_events;
+static uint8_t tool_events_count;
+static uint8_t tool_events_next;
+static uint32_t tick;
+
+static const tool_raster *raster;
+static uint16_t raster_pixel;
+static uint16_t raster_ticks;   // ticks till next pixel
+
+static uint8_t touched_stops;  // endstops, which have broken last move
+
+static double target_feed;
+static double pwm_time;         // time since last update of PWM tools. sec
+
+static volatile float feed_override = 1;    // requested override, is applied from step tick
+static volatile bool hold;                  // feed hold is requested
+
+#define HOLD_POLL_US 1000   // delay of ticks when move is held
+
+// Events of broken move are dropped, but tools which they switch off are switched off
+static void clear_tool_events(void)
+{
+    while (tool_events_next < tool_events_count)
+    {
+        const tool_event *ev = &tool_events[tool_events_next++];
+        if (!ev->on)
+            tool_set(ev->id, false);
+    }
+    tool_events_count = 0;
+    tool_events_next = 0;
+    if (raster != NULL)
+    {
+        tool_raster_pixel(raster, raster->pixels);
+        raster = NULL;
+    }
+}
+
+static void raster_tick(void)
+{
+    if (raster == NULL)
+        return;
+    if (raster_ticks == 0)
+    {
+        raster_ticks = raster->pitch;
+        tool_raster_pixel(raster, raster_pixel++);
+    }
+    raster_ticks--;
+}
+
+void moves_set_tool_raster(const tool_raster *r)
+{
+    raster = r;
+    raster_pixel = 0;
+    raster_ticks = 0;
+    tool_raster_start();
+}
+
+static void fire_tool_events(uint32_t step)
+{
+    while (tool_events_next < tool_events_count && tool_events[tool_events_next].step <= step)
+    {
+        const tool_event *ev = &tool_events[tool_events_next++];
+        tool_set(ev->id, ev->on);
+    }
+}
+
+void moves_set_tool_events(const tool_event *events, int count)
+{
+    tool_events = events;
+    tool_events_count = count;
+    tool_events_next = 0;
+}
+
+void moves_set_feed_override(double k)
+{
+    feed_override = k;
+}
+
+/*
+ * Moves switch tools from step tick, so hold is passed to tools from there
+ * too. Stopped moves have no ticks, then it is passed at once, or by the
+ * last tick, if it finishes the move meanwhile.
+ */
+void moves_set_hold(bool h)
+{
+    hold = h;
+    if (current_move_type == MOVE_NONE)
+        tools_set_hold(h);
+}
+
+bool moves_is_held(void)
+{
+    return hold;
+}
+
+/* hold is override 0, moves slow down to base feed */
+static bool feed_override_changed(void)
+{
+    double k = hold ? 0 : feed_override;
+    if (k == moves_common_feed_override())
+        return false;
+    moves_common_set_feed_override(k);
+    return true;
+}
+
+static int move_started(int res, double feed)
+{
+    tick = 0;
+    touched_stops = 0;
+    target_feed = feed;
+    pwm_time = TOOL_PWM_PERIOD;
+    if (res == -E_NEXT)
+    {
+        fire_tool_events(UINT32_MAX);
+        clear_tool_events();
+    }
+    return res;
+}
+
+static double movement_feed(void)
+{
+    switch (current_move_type)
+    {
+    case MOVE_LINE:
+        return line_movement_feed();
+    case MOVE_ARC:
+        return arc_movement_feed();
+    case MOVE_SPLINE:
+        return spline_movement_feed();
+    default:
+        return 0;
+    }
+}
+
 void moves_break(void)
 {
     current_move_type = MOVE_NONE;
+    hold = false;
+    tools_cancel_hold();
+    moves_common_set_exit_feed(0);
+    clear_tool_events();
 }
 
 void moves_init(const steppers_definition *definition)
 {
     current_move_type = MOVE_NONE;
+    clear_tool_events();
     moves_common_init(definition);
     moves_common_reset();
 }
@@ -25,6 +166,9 @@ void moves_init(const steppers_definition *definition)
 void moves_reset(void)
 {
     current_move_type = MOVE_NONE;
+    hold = false;
+    tools_cancel_hold();
+    clear_tool_events();
     moves_common_reset();
 }
 
@@ -32,36 +176,86 @@ int moves_line_to(line_plan *plan)
 {
     ready = true;
     current_move_type = MOVE_LINE;
-    return line_move_to(plan);
+    feed_override_changed();
+    return move_started(line_move_to(plan), plan->feed);
 }
 
 int moves_arc_to(arc_plan *plan)
 {
     ready = true;
     current_move_type = MOVE_ARC;
-    return arc_move_to(plan);
+    feed_override_changed();
+    return move_started(arc_move_to(plan), plan->feed);
+}
+
+int moves_spline_to(spline_plan *plan)
+{
+    ready = true;
+    current_move_type = MOVE_SPLINE;
+    feed_override_changed();
+    return move_started(spline_move_to(plan), plan->feed);
+}
+
+// Move is over, next one can be started by callback
+static void move_stopped(void (*callback)(void))
+{
+    current_move_type = MOVE_NONE;
+    callback();
+    if (current_move_type == MOVE_NONE)
+        tools_set_hold(hold);
 }
 
 int32_t moves_step_tick(void)
 {
-    /* Check endstops */
-    bool es;
+    /* Check endstops. Moves keep mask of endstops for their direction */
+    uint8_t stops = 0;
+
+    if (current_move_type == MOVE_NONE)
+        return -1;
+    tools_set_hold(hold);
     if (current_move_type == MOVE_LINE)
     {
-        es = line_check_endstops();
+        stops = line_endstops();
     }
     else if (current_move_type == MOVE_ARC)
     {
-        es = arc_check_endstops();
+        stops = arc_endstops();
     }
-    if (es)
+    else if (current_move_type == MOVE_SPLINE)
     {
-        moves_common_endstops_touched();
+        stops = spline_endstops();
+    }
+    if (stops != 0)
+        touched_stops = moves_common_endstops() & stops;
+    if (stops != 0 && touched_stops != 0)
+    {
+        clear_tool_events();
+        move_stopped(moves_common_endstops_touched);
         return -1;
     }
    
+    if (feed_override_changed())
+    {
+        if (current_move_type == MOVE_LINE)
+        {
+            line_feed_override();
+        }
+        else if (current_move_type == MOVE_ARC)
+        {
+            arc_feed_override();
+        }
+        else if (current_move_type == MOVE_SPLINE)
+        {
+            spline_feed_override();
+        }
+    }
+
     if (ready)
     {
+        /* Held move waits on base feed, its state is kept for resume */
+        if (hold && movement_feed() <= moves_common_def.feed_base)
+            return HOLD_POLL_US;
+
         /* Normal movement */
         int res;
         if (current_move_type == MOVE_LINE)
@@ -72,11 +266,17 @@ int32_t moves_step_tick(void)
         {
             res = arc_step_tick();
         }
+        else if (current_move_type == MOVE_SPLINE)
+        {
+            res = spline_step_tick();
+        }
 
         if (res == -E_OK)
         {
             double len;
             double dt;
+            fire_tool_events(tick++);
+            raster_tick();
             ready = moves_common_make_steps(&len);
             if (current_move_type == MOVE_LINE)
             {
@@ -86,11 +286,26 @@ int32_t moves_step_tick(void)
             {
                 dt = arc_acceleration_process(len);
             }
+            else if (current_move_type == MOVE_SPLINE)
+            {
+                dt = spline_acceleration_process(len);
+            }
+
+            /* PWM of tools follows feed, but not on every step */
+            pwm_time += dt;
+            if (pwm_time >= TOOL_PWM_PERIOD)
+            {
+                pwm_time = 0;
+                tools_feed_update(movement_feed() / target_feed);
+            }
             return dt * 1000000UL;
         }
         else if (res == -E_NEXT)
         {
-            moves_common_line_finished();
+            moves_common_set_exit_feed(movement_feed());
+            fire_tool_events(UINT32_MAX);
+            clear_tool_events();
+            move_stopped(moves_common_line_finished);
             return -1;
         }
     }
@@ -107,11 +322,20 @@ int32_t moves_step_tick(void)
         {
             dt = len / arc_movement_feed();
         }
+        else if (current_move_type == MOVE_SPLINE)
+        {
+            dt = len / spline_movement_feed();
+        }
         return dt * 1000000UL;
     }
     return -1;
 }
 
+uint8_t moves_touched_endstops(void)
+{
+    return touched_stops;
+}
+
 cnc_endstops moves_get_endstops(void)
 {
     return moves_common_def.get_endstops();
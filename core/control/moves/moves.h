@@ -1,10 +1,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <control/moves/moves_common/steppers.h>
 #include <control/moves/moves_line/line.h>
 #include <control/moves/moves_arc/arc.h>
+#include <control/moves/moves_spline/spline.h>
+#include <control/tools/tools.h>
 
 void moves_init(const steppers_definition *definition);
 void moves_reset(void);
@@ -12,8 +15,26 @@ void moves_break(void);
 
 int moves_line_to(line_plan *plan);
 int moves_arc_to(arc_plan *plan);
+int moves_spline_to(spline_plan *plan);
+
+// tool events of next move, sorted by step. Events after end of move are fired when it finishes
+void moves_set_tool_events(const tool_event *events, int count);
+
+// power levels of tool along next line, tool is switched off when line finishes
+void moves_set_tool_raster(const tool_raster *raster);
+
+// scale feeds of moves by k. Running move ramps to new feed, next moves start with it
+void moves_set_feed_override(double k);
+
+// feed hold: move slows down to base feed and waits keeping its state,
+// it accelerates back when hold is released. Tools are off while hold is set
+void moves_set_hold(bool hold);
+bool moves_is_held(void);
 
 int32_t moves_step_tick(void);
 
 cnc_endstops moves_get_endstops(void);
 
+// endstops, which have broken last move. ENDSTOP_*
+uint8_t moves_touched_endstops(void);
+
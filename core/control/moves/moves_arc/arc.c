@@ -37,6 +37,7 @@ static struct arc_state_s
     int8_t steps[3];
 
     int32_t dir[3];
+    uint8_t stops;
     acceleration_state acc;
 } current_state;
 
@@ -64,6 +65,51 @@ static void global_update_position(struct arc_state_s *state)
     }
 }
 
+static void plane_to_global(arc_plane plane, const int32_t *p, int32_t *g)
+{
+    switch (plane)
+    {
+        case XY:
+            g[0] = p[0];
+            g[1] = p[1];
+            g[2] = p[2];
+            break;
+        case YZ:
+            g[0] = p[2];
+            g[1] = p[0];
+            g[2] = p[1];
+            break;
+        case ZX:
+            g[0] = p[1];
+            g[1] = p[2];
+            g[2] = p[0];
+            break;
+    }
+}
+
+static void update_stops(struct arc_state_s *state)
+{
+    state->stops = moves_common_dir_stops(current_plan->stops, state->dir[0], state->dir[1], state->dir[2]);
+}
+
+// direction is changed only by steps, so mask of endstops is recalculated rarely
+static void update_dir(struct arc_state_s *state)
+{
+    int i;
+    bool changed = false;
+    for (i = 0; i < 3; i++)
+    {
+        int d = state->steps[i];
+        if ((d > 0 && state->dir[i] <= 0) || (d < 0 && state->dir[i] >= 0))
+        {
+            state->dir[i] = d;
+            changed = true;
+        }
+    }
+    if (changed)
+        update_stops(state);
+}
+
 static bool iterate(arc_plan *plan, struct arc_state_s *state)
 {
     if (state->plane.x == plan->x2[0] &&
@@ -122,15 +168,14 @@ static bool iterate(arc_plan *plan, struct arc_state_s *state)
     global_update_position(state);
     for (i = 0; i < 3; i++)
         state->steps[i] = state->global.position[i] - oldpos[i];
+    update_dir(state);
     return true;
 }
 
 // module API functions
-bool arc_check_endstops(void)
+uint8_t arc_endstops(void)
 {
-    if (current_plan->check_break && current_plan->check_break(current_state.dir, current_plan->check_break_data))
-        return true;
-    return false;
+    return current_state.stops;
 }
 
 int arc_step_tick(void)
@@ -178,10 +223,38 @@ static void arc_init_move(arc_plan *plan, struct arc_state_s *state)
     state->plane.z = 0;
 
     global_update_position(state);
+
+    /* initial direction is tangent of arc */
+    int sign = plan->cw ? -1 : 1;
+    int32_t pdir[3] = {
+        sign * round(-plan->a * state->sint),
+        sign * round(plan->b * state->cost),
+        sign * round(plan->h),
+    };
+    plane_to_global(plan->plane, pdir, state->dir);
+    update_stops(state);
 //    printf("=================\nstart %lf %lf\n", plan->t_start, plan->t_end);
 //    printf("Start: %i %i : %i %i : %i %i\n", (int)plan->x2[0], (int)plan->x2[1], (int)state->plane_current.x, (int)state->plane_current.y, (int)state->plane_target.x, (int)state->plane_target.y);
 }
 
+// feeds of current move with feed override
+static void override_feeds(void)
+{
+    double feed = moves_common_override_feed(current_plan->feed);
+    double feed1 = moves_common_override_junction(current_plan->feed1);
+    if (feed1 > feed)
+        feed1 = feed;
+
+    acceleration_set_target(&current_state.acc, feed, feed1, current_plan->len);
+    current_state.acc.dec_t = acceleration(feed1, feed, current_plan->acceleration, current_plan->len,
+                                           current_plan->t_end, current_plan->t_start);
+}
+
+void arc_feed_override(void)
+{
+    override_feeds();
+}
+
 int arc_move_to(arc_plan *plan)
 {
     current_plan = plan;
@@ -201,6 +274,12 @@ int arc_move_to(arc_plan *plan)
     current_state.acc.end_t     = current_plan->t_end;
     current_state.acc.acc_t     = current_plan->t_acc;
     current_state.acc.dec_t     = current_plan->t_dec;
+    double feed0 = moves_common_start_feed(current_plan->feed0);
+    if (feed0 != current_plan->feed0 || moves_common_feed_override() != 1)
+    {
+        current_state.acc.feed = feed0;
+        override_feeds();
+    }
  
     arc_init_move(plan, &current_state);
 
@@ -208,20 +287,30 @@ int arc_move_to(arc_plan *plan)
     return -E_OK;
 }
 
+static void arc_angles(const arc_plan *arc, double *t_start, double *t_end)
+{
+    *t_start = atan2(arc->x1[1], arc->x1[0]);
+    *t_end = atan2(arc->x2[1], arc->x2[0]);
+    if (arc->cw)
+    {
+        while (*t_end > *t_start)
+            *t_end -= 2*pi;
+    }
+    else
+    {
+        while (*t_end < *t_start)
+            *t_end += 2*pi;
+    }
+}
+
 void arc_pre_calculate(arc_plan *arc)
 {
     double stpu_x;
     double stpu_y;
     double stpu_z;
     
-    double x1, y1;
-    double x2, y2;
     double H;
 
-    x1 = arc->x1[0];
-    y1 = arc->x1[1];
-    x2 = arc->x2[0];
-    y2 = arc->x2[1];
     H  = arc->H;
 
     switch (arc->plane)
@@ -243,18 +332,7 @@ void arc_pre_calculate(arc_plan *arc)
         break;
     }
 
-    arc->t_start = atan2(y1, x1);
-    arc->t_end = atan2(y2, x2);
-    if (arc->cw)
-    {
-        while (arc->t_end > arc->t_start)
-            arc->t_end -= 2*pi;
-    }
-    else
-    {
-        while (arc->t_end < arc->t_start)
-            arc->t_end += 2*pi;
-    }
+    arc_angles(arc, &arc->t_start, &arc->t_end);
 
     arc->h = H / (arc->t_end - arc->t_start);
     arc->cost_start = cos(arc->t_start);
@@ -283,3 +361,52 @@ void arc_pre_calculate(arc_plan *arc)
     arc->ready = 1;
 }
 
+void arc_bounds(const arc_plan *arc, int32_t *end, int32_t *lo, int32_t *hi)
+{
+    double t_start, t_end, t_min, t_max, t;
+    double plo[3], phi[3];
+    int32_t l[3], h[3], e[3];
+    int i;
+
+    arc_angles(arc, &t_start, &t_end);
+    t_min = fmin(t_start, t_end);
+    t_max = fmax(t_start, t_end);
+
+    /* extremums of ellipse are at ends and at multiples of pi/2 between them */
+    plo[0] = phi[0] = arc->a * cos(t_start);
+    plo[1] = phi[1] = arc->b * sin(t_start);
+    for (t = ceil(t_min / (pi/2)) * (pi/2); t <= t_max + pi/2; t += pi/2)
+    {
+        double x, y;
+        if (t > t_max)
+            t = t_max;
+        x = arc->a * cos(t);
+        y = arc->b * sin(t);
+        plo[0] = fmin(plo[0], x);
+        phi[0] = fmax(phi[0], x);
+        plo[1] = fmin(plo[1], y);
+        phi[1] = fmax(phi[1], y);
+        if (t == t_max)
+            break;
+    }
+    plo[2] = fmin(0, arc->H);
+    phi[2] = fmax(0, arc->H);
+
+    /* relative to start point, arc begins from it */
+    for (i = 0; i < 2; i++)
+    {
+        plo[i] = fmin(plo[i] - arc->x1[i], 0);
+        phi[i] = fmax(phi[i] - arc->x1[i], 0);
+    }
+    for (i = 0; i < 3; i++)
+    {
+        l[i] = floor(plo[i]);
+        h[i] = ceil(phi[i]);
+    }
+    e[0] = round(arc->x2[0] - arc->x1[0]);
+    e[1] = round(arc->x2[1] - arc->x1[1]);
+    e[2] = round(arc->H);
+    plane_to_global(arc->plane, e, end);
+    plane_to_global(arc->plane, l, lo);
+    plane_to_global(arc->plane, h, hi);
+}
@@ -22,8 +22,7 @@ typedef struct {
     double feed1;           // finishing feed
     uint32_t acceleration;  // acceleration
 
-    int (*check_break)(int32_t *dx, void *user_arg);
-    void *check_break_data;
+    uint8_t stops;          // endstops, which break move. ENDSTOP_*
 
     // Pre-calculated data
     double len;            // arc length
@@ -49,5 +48,12 @@ int arc_move_to(arc_plan *plan);
 int arc_step_tick(void);
 double arc_movement_feed(void);
 double arc_acceleration_process(double len);
-bool arc_check_endstops(void);
+// endstops, which break current move in its current direction
+uint8_t arc_endstops(void);
+
+// apply changed feed override to current move
+void arc_feed_override(void);
+
+// end point and bounding box of arc relative to its start. steps
+void arc_bounds(const arc_plan *arc, int32_t *end, int32_t *lo, int32_t *hi);
 
@@ -26,13 +26,18 @@ void acceleration_process(acceleration_state *state, double step_delay, double t
             if (cur_dt < dec_dt)
             {
                 state->type = STATE_GO;
-                state->feed = state->target_feed;
+                if (state->feed < state->target_feed)
+                    state->feed = state->target_feed;
             }
             else
             {
                 state->type = STATE_DEC;
             }
         }
+        else if (cur_dt >= dec_dt)
+        {
+            state->type = STATE_DEC;
+        }
         else
         {
             state->feed = accelerate(state->feed, state->acceleration, step_delay);
@@ -44,9 +49,27 @@ void acceleration_process(acceleration_state *state, double step_delay, double t
         {
             state->type = STATE_DEC;
         }
+        else if (state->feed > state->target_feed)
+        {
+            /* target feed is lowered by override */
+            state->feed = accelerate(state->feed, -state->acceleration, step_delay);
+            if (state->feed < state->target_feed)
+                state->feed = state->target_feed;
+        }
         break;
     case STATE_DEC:
     {
+        if (state->feed < state->end_feed)
+        {
+            /* resumed move ramps back to its end feed */
+            state->feed = accelerate(state->feed, state->acceleration, step_delay);
+            if (state->feed >= state->end_feed)
+            {
+                state->feed = state->end_feed;
+                state->type = STATE_STOP_COMPLETION;
+            }
+            break;
+        }
         state->feed = accelerate(state->feed, -state->acceleration, step_delay);
         if (state->feed < state->end_feed)
         {
@@ -61,6 +84,46 @@ void acceleration_process(acceleration_state *state, double step_delay, double t
     }
 }
 
+// Change feeds of running movement
+//
+// len. length of whole movement, mm
+//
+// Movement accelerates from current feed to higher target feed or slows down to lower one.
+// Deceleration point isn't changed here, it depends on parametrization of movement.
+// Decelerating movement goes to new end feed, so it ramps back to its end feed, when
+// it is resumed after hold
+void acceleration_set_target(acceleration_state *state, double target_feed, double end_feed, double len)
+{
+    state->target_feed = target_feed;
+    state->end_feed = end_feed;
+    if (state->type == STATE_STOP)
+        return;
+    if (state->type == STATE_DEC || state->type == STATE_STOP_COMPLETION)
+    {
+        if (state->acceleration <= 0)
+            state->feed = end_feed;
+        else if (state->feed != end_feed)
+            state->type = STATE_DEC;
+        return;
+    }
+    if (state->acceleration <= 0)
+    {
+        state->feed = target_feed;
+        state->type = STATE_GO;
+    }
+    else if (target_feed > state->feed)
+    {
+        state->acc_t = acceleration(state->feed, target_feed, state->acceleration, len,
+                                    state->current_t, state->current_t + state->end_t - state->start_t);
+        state->type = STATE_ACC;
+    }
+    else
+    {
+        state->acc_t = state->current_t;
+        state->type = STATE_GO;
+    }
+}
+
 // Find new feed when acceleration
 //
 // feed.  mm / sec
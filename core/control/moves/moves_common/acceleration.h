@@ -27,6 +27,9 @@ typedef struct {
 
 void acceleration_process(acceleration_state *state, double step_delay, double current_t);
 
+// change target and end feed of running movement, len - length of movement
+void acceleration_set_target(acceleration_state *state, double target_feed, double end_feed, double len);
+
 double accelerate(double feed, double acc, double delay);
 double acceleration(double feed0,
                     double feed1,
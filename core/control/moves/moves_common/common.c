@@ -11,6 +11,9 @@ static double moves_len[2][2][2] = {};
 cnc_position position;
 steppers_definition moves_common_def;
 
+static double feed_override = 1;
+static double exit_feed;        // feed at end of last move, 0 - no limit
+
 void moves_common_init(const steppers_definition *definition)
 {
     memcpy(&moves_common_def, definition, sizeof(moves_common_def));
@@ -34,6 +37,7 @@ void moves_common_reset(void)
         position.target_pos[i] = 0;
         position.pos[i] = 0;
     }
+    exit_feed = 0;
 }
 
 // Find delay between ticks
@@ -50,6 +54,49 @@ double feed2delay(double feed, double step_len)
 }
 
 
+// Feed override
+void moves_common_set_feed_override(double k)
+{
+    feed_override = k;
+}
+
+double moves_common_feed_override(void)
+{
+    return feed_override;
+}
+
+double moves_common_override_feed(double feed)
+{
+    feed *= feed_override;
+    if (feed < moves_common_def.feed_base)
+        feed = moves_common_def.feed_base;
+    else if (moves_common_def.feed_max > 0 && feed > moves_common_def.feed_max)
+        feed = moves_common_def.feed_max;
+    return feed;
+}
+
+double moves_common_override_junction(double feed)
+{
+    if (feed_override < 1)
+        feed *= feed_override;
+    if (feed < moves_common_def.feed_base)
+        feed = moves_common_def.feed_base;
+    return feed;
+}
+
+void moves_common_set_exit_feed(double feed)
+{
+    exit_feed = feed;
+}
+
+double moves_common_start_feed(double feed0)
+{
+    feed0 = moves_common_override_junction(feed0);
+    if (exit_feed > 0 && feed0 > exit_feed)
+        feed0 = exit_feed;
+    return feed0;
+}
+
 // Movement functions
 void moves_common_set_dir(int i, bool dir)
 {
@@ -110,6 +157,29 @@ void moves_common_line_started(void)
         moves_common_def.line_started();
 }
 
+uint8_t moves_common_endstops(void)
+{
+    cnc_endstops stops = moves_common_def.get_endstops();
+    return (stops.stop_x ? ENDSTOP_X : 0) |
+           (stops.stop_y ? ENDSTOP_Y : 0) |
+           (stops.stop_z ? ENDSTOP_Z : 0) |
+           (stops.probe ? ENDSTOP_PROBE : 0);
+}
+
+uint8_t moves_common_dir_stops(uint8_t stops, int32_t dx, int32_t dy, int32_t dz)
+{
+    uint8_t mask = 0;
+    if (dx < 0)
+        mask |= ENDSTOP_X;
+    if (dy < 0)
+        mask |= ENDSTOP_Y;
+    if (dz < 0)
+        mask |= ENDSTOP_Z;
+    else
+        mask |= ENDSTOP_PROBE;
+    return stops & mask;
+}
+
 void moves_common_endstops_touched(void)
 {
     if (moves_common_def.endstops_touched)
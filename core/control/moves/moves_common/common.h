@@ -6,6 +6,13 @@
 
 #include <control/moves/moves_common/steppers.h>
 
+// Endstops as bit mask
+#define ENDSTOP_X       0x01
+#define ENDSTOP_Y       0x02
+#define ENDSTOP_Z       0x04
+#define ENDSTOP_PROBE   0x08
+#define ENDSTOPS_AXES   (ENDSTOP_X | ENDSTOP_Y | ENDSTOP_Z)
+
 typedef struct {
     uint8_t en:1;
     uint8_t dir:1;
@@ -25,6 +32,22 @@ double feed2delay(double feed, double step_len);
 void moves_common_init(const steppers_definition *definition);
 void moves_common_reset(void);
 
+// Feed override
+void moves_common_set_feed_override(double k);
+double moves_common_feed_override(void);
+
+// feed of movement scaled by override, within base and max feed
+double moves_common_override_feed(double feed);
+
+// start and end feeds are only lowered by override, so moves still can stop as planned
+double moves_common_override_junction(double feed);
+
+// feed at end of last move, 0 - unknown
+void moves_common_set_exit_feed(double feed);
+
+// feed at start of move with override, not higher than at end of previous one
+double moves_common_start_feed(double feed0);
+
 // Movement functions
 void moves_common_set_dir(int i, bool dir);
 void moves_common_make_step(int i);
@@ -38,6 +61,14 @@ void moves_common_line_finished(void);
 
 double moves_common_step_len(int8_t dx, int8_t dy, int8_t dz);
 
+// Endstops
+// read state of endstops as mask
+uint8_t moves_common_endstops(void);
+
+// endstops from stops, which can break move in direction dx, dy, dz:
+// axis endstop when moving to its negative side, probe when not moving up
+uint8_t moves_common_dir_stops(uint8_t stops, int32_t dx, int32_t dy, int32_t dz);
+
 // State
 void moves_common_set_position(const int32_t *x);
 
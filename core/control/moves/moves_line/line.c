@@ -13,6 +13,7 @@ static line_plan *current_plan;
 static struct
 {
     int8_t dir[3];
+    uint8_t stops;
     int32_t steps[3];
     int32_t err[3];
     int is_moving;
@@ -22,6 +23,25 @@ static struct
     int32_t start_pos[3];
 } current_state;
 
+// feeds of current move with feed override
+static void override_feeds(void)
+{
+    double feed = moves_common_override_feed(current_plan->feed);
+    double feed1 = moves_common_override_junction(current_plan->feed1);
+    if (feed1 > feed)
+        feed1 = feed;
+
+    acceleration_set_target(&current_state.acc, feed, feed1, current_plan->len);
+    current_state.acc.dec_t = acceleration(feed1, feed, current_plan->acceleration, current_plan->len, current_plan->steps, 0);
+    if (current_state.acc.dec_t < 0)
+        current_state.acc.dec_t = 0;
+}
+
+void line_feed_override(void)
+{
+    override_feeds();
+}
+
 int line_move_to(line_plan *plan)
 {
     int i;
@@ -42,6 +62,8 @@ int line_move_to(line_plan *plan)
             current_state.dir[i] = 0;
         current_state.steps[i] = 0;
     }
+    current_state.stops = moves_common_dir_stops(current_plan->stops, current_plan->x[0],
+                                                 current_plan->x[1], current_plan->x[2]);
 
     if (current_plan->steps == 0)
         return -E_NEXT;
@@ -57,6 +79,12 @@ int line_move_to(line_plan *plan)
     current_state.acc.end_t     = current_plan->steps;
     current_state.acc.acc_t     = current_plan->acc_steps;
     current_state.acc.dec_t     = current_plan->dec_steps;
+    double feed0 = moves_common_start_feed(current_plan->feed0);
+    if (feed0 != current_plan->feed0 || moves_common_feed_override() != 1)
+    {
+        current_state.acc.feed = feed0;
+        override_feeds();
+    }
     current_state.is_moving = 1;
     for (i = 0; i < 3; i++)
     {
@@ -93,14 +121,9 @@ static bool make_step(void)
     return true;
 }
 
-bool line_check_endstops(void)
+uint8_t line_endstops(void)
 {
-    // Check for endstops
-    if (current_plan->check_break && current_plan->check_break(current_plan->x, current_plan->check_break_data))
-    {
-        return true;
-    }
-    return false;
+    return current_state.stops;
 }
 
 int line_step_tick(void)
@@ -128,7 +151,7 @@ double line_acceleration_process(double len)
     return dt;
 }
 
-static void bresenham_plan(line_plan *plan)
+void line_bresenham_plan(line_plan *plan)
 {
     int i;
     plan->steps = abs(plan->x[0]);
@@ -175,7 +198,7 @@ void line_pre_calculate(line_plan *line)
     else if (line->feed0 > line->feed)
         line->feed0 = line->feed;
 
-    bresenham_plan(line);
+    line_bresenham_plan(line);
     line->acc_steps = acceleration(line->feed0, line->feed, line->acceleration, line->len, 0, line->steps);
     line->dec_steps = acceleration(line->feed1, line->feed, line->acceleration, line->len, line->steps, 0);
 
@@ -12,8 +12,7 @@ typedef struct {
     double feed0; // initial feed.       mm / sec
     double feed1; // finishing feed.     mm / sec
     double acceleration; // acceleration mm / sec^2
-    int (*check_break)(int32_t *dx, void *user_arg);
-    void *check_break_data;
+    uint8_t stops;       // endstops, which break move. ENDSTOP_*
 
     // Pre-calculated data
     double len;            // length of delta. mm
@@ -26,6 +25,9 @@ typedef struct {
 // pre-calculate parameters of moving
 void line_pre_calculate(line_plan *line);
 
+// axis with max steps and total amount of steps, integer only
+void line_bresenham_plan(line_plan *line);
+
 // init line moving
 int line_move_to(line_plan *plan);
 
@@ -36,5 +38,9 @@ double line_acceleration_process(double delay);
 
 double line_movement_feed(void);
 
-bool line_check_endstops(void);
+// endstops, which break current move
+uint8_t line_endstops(void);
+
+// apply changed feed override to current move
+void line_feed_override(void);
 
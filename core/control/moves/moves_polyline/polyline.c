@@ -0,0 +1,241 @@
+#include <math.h>
+
+#include <control/moves/moves_common/common.h>
+#include <control/moves/moves_polyline/polyline.h>
+#include <err/err.h>
+
+/*
+ * Polyline is a chain of line segments, received as one command.
+ * Each segment is a delta of 3 zigzag-encoded varints (LEB128).
+ * Segments are executed as separate lines, feeds at junctions are
+ * limited by junction deviation and acceleration along the chain.
+ */
+
+#define JUNCTION_DEVIATION 0.01 // mm
+
+static int read_varint(const uint8_t *data, size_t len, size_t *pos, int32_t *val)
+{
+    uint32_t v = 0;
+    int shift = 0;
+    while (*pos < len && shift < 35)
+    {
+        uint8_t b = data[(*pos)++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            *val = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+            return -E_OK;
+        }
+        shift += 7;
+    }
+    return -E_INCORRECT;
+}
+
+static int read_delta(const uint8_t *data, size_t len, size_t *pos, int32_t *x)
+{
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        int res = read_varint(data, len, pos, &x[i]);
+        if (res != -E_OK)
+            return res;
+    }
+    return -E_OK;
+}
+
+ssize_t polyline_count(const uint8_t *data, size_t len)
+{
+    size_t pos = 0;
+    ssize_t count = 0;
+    while (pos < len)
+    {
+        int32_t x[3];
+        if (read_delta(data, len, &pos, x) != -E_OK)
+            return -1;
+        count++;
+    }
+    return count;
+}
+
+void polyline_bounds(const uint8_t *data, size_t len, int32_t *end, int32_t *lo, int32_t *hi)
+{
+    size_t pos = 0;
+    int32_t x[3];
+    int i;
+
+    for (i = 0; i < 3; i++)
+        end[i] = lo[i] = hi[i] = 0;
+    while (pos < len && read_delta(data, len, &pos, x) == -E_OK)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            end[i] += x[i];
+            if (end[i] < lo[i])
+                lo[i] = end[i];
+            if (end[i] > hi[i])
+                hi[i] = end[i];
+        }
+    }
+}
+
+static double junction_feed(const double *u1, const double *u2, double feed, double acc)
+{
+    int i;
+    double cos_theta = 0;
+    for (i = 0; i < 3; i++)
+        cos_theta -= u1[i] * u2[i];
+
+    if (cos_theta < -0.999999)
+        return feed;
+    if (cos_theta > 0.999999)
+        return moves_common_def.feed_base;
+
+    double sin_theta_d2 = sqrt(0.5 * (1 - cos_theta));
+    double v = sqrt(acc * JUNCTION_DEVIATION * sin_theta_d2 / (1 - sin_theta_d2));
+    return v < feed ? v : feed;
+}
+
+void polyline_pre_calculate(polyline_plan *polyline)
+{
+    int k, i;
+    int last = -1;
+    size_t pos = 0;
+    double prev_u[3];
+    polyline_segment *seg = polyline->segments;
+
+    if (polyline->feed < moves_common_def.feed_base)
+        polyline->feed = moves_common_def.feed_base;
+    else if (moves_common_def.feed_max > 0 && polyline->feed > moves_common_def.feed_max)
+        polyline->feed = moves_common_def.feed_max;
+
+    if (polyline->feed1 < moves_common_def.feed_base)
+        polyline->feed1 = moves_common_def.feed_base;
+    else if (polyline->feed1 > polyline->feed)
+        polyline->feed1 = polyline->feed;
+
+    if (polyline->feed0 < moves_common_def.feed_base)
+        polyline->feed0 = moves_common_def.feed_base;
+    else if (polyline->feed0 > polyline->feed)
+        polyline->feed0 = polyline->feed;
+
+    /* junction feeds */
+    for (k = 0; k < polyline->count; k++)
+    {
+        int32_t x[3];
+        double u[3];
+        double l = 0;
+        read_delta(polyline->data, polyline->data_len, &pos, x);
+        for (i = 0; i < 3; i++)
+        {
+            u[i] = x[i] / moves_common_def.steps_per_unit[i];
+            l += u[i] * u[i];
+        }
+        l = sqrt(l);
+        seg[k].len = l;
+        seg[k].feed1 = polyline->feed;
+        if (l == 0)
+            continue;
+
+        for (i = 0; i < 3; i++)
+            u[i] /= l;
+        if (last >= 0)
+            seg[last].feed1 = junction_feed(prev_u, u, polyline->feed, polyline->acceleration);
+        for (i = 0; i < 3; i++)
+            prev_u[i] = u[i];
+        last = k;
+    }
+    if (last >= 0)
+        seg[last].feed1 = polyline->feed1;
+
+    /* we must be able to decelerate to the end */
+    if (polyline->acceleration > 0)
+    {
+        double next_max = polyline->feed1;
+        for (k = last; k >= 0; k--)
+        {
+            if (seg[k].len == 0)
+                continue;
+            if (seg[k].feed1 > next_max)
+                seg[k].feed1 = next_max;
+            next_max = sqrt(seg[k].feed1 * seg[k].feed1 + 2 * polyline->acceleration * seg[k].len);
+        }
+
+        /* and accelerate from the start */
+        double entry = polyline->feed0;
+        for (k = 0; k <= last; k++)
+        {
+            if (seg[k].len == 0)
+                continue;
+            double max = sqrt(entry * entry + 2 * polyline->acceleration * seg[k].len);
+            if (seg[k].feed1 > max)
+                seg[k].feed1 = max;
+            if (seg[k].feed1 < moves_common_def.feed_base)
+                seg[k].feed1 = moves_common_def.feed_base;
+            entry = seg[k].feed1;
+        }
+    }
+
+    /* acceleration of segments, so moving to next segment doesn't need floating point */
+    line_plan line;
+    line.feed = polyline->feed;
+    line.feed1 = polyline->feed0;
+    line.acceleration = polyline->acceleration;
+    line.stops = polyline->stops;
+    pos = 0;
+    for (k = 0; k < polyline->count; k++)
+    {
+        read_delta(polyline->data, polyline->data_len, &pos, line.x);
+        if (seg[k].len == 0)
+            continue;
+        line.feed0 = line.feed1;
+        line.feed1 = seg[k].feed1;
+        line_pre_calculate(&line);
+        seg[k].feed1 = line.feed1;
+        seg[k].acc_steps = line.acc_steps;
+        seg[k].dec_steps = line.dec_steps;
+    }
+
+    polyline->ready = true;
+}
+
+bool polyline_start(polyline_plan *polyline)
+{
+    if (!polyline->ready)
+        polyline_pre_calculate(polyline);
+
+    polyline->cur = 0;
+    polyline->data_pos = 0;
+    polyline->line.feed1 = polyline->feed0;
+    return polyline_next(polyline);
+}
+
+bool polyline_next(polyline_plan *polyline)
+{
+    while (polyline->cur < polyline->count)
+    {
+        size_t pos = polyline->data_pos;
+        int k = polyline->cur++;
+        line_plan *line = &polyline->line;
+        int32_t x[3];
+
+        read_delta(polyline->data, polyline->data_len, &pos, x);
+        polyline->data_pos = pos;
+        if (x[0] == 0 && x[1] == 0 && x[2] == 0)
+            continue;
+
+        line->feed0 = line->feed1;
+        line->feed1 = polyline->segments[k].feed1;
+        line->feed = polyline->feed;
+        line->acceleration = polyline->acceleration;
+        line->stops = polyline->stops;
+        line->x[0] = x[0];
+        line->x[1] = x[1];
+        line->x[2] = x[2];
+        line->len = polyline->segments[k].len;
+        line->acc_steps = polyline->segments[k].acc_steps;
+        line->dec_steps = polyline->segments[k].dec_steps;
+        line_bresenham_plan(line);
+        return true;
+    }
+    return false;
+}
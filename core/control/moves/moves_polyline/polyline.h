@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include <control/moves/moves_line/line.h>
+
+typedef struct {
+    float len;          // segment length. mm
+    float feed1;        // feed at end of segment. mm / sec
+    uint32_t acc_steps; // steps on acceleration
+    uint32_t dec_steps; // steps on deceleration
+} polyline_segment;
+
+typedef struct {
+    // Specified data
+    double feed;            // feed of moving.     mm / sec
+    double feed0;           // initial feed.       mm / sec
+    double feed1;           // finishing feed.     mm / sec
+    double acceleration;    // acceleration mm / sec^2
+    uint8_t stops;          // endstops, which break move. ENDSTOP_*
+
+    const uint8_t *data;    // vertices deltas, zigzag varints dx, dy, dz. steps
+    uint16_t data_len;
+    uint16_t count;         // amount of segments
+
+    // Pre-calculated data
+    polyline_segment *segments;
+    bool ready;
+
+    // Running data
+    uint16_t cur;           // next segment
+    uint16_t data_pos;      // next segment position in data
+    line_plan line;         // current segment
+} polyline_plan;
+
+// count segments in packed data, -1 if data is incorrect
+ssize_t polyline_count(const uint8_t *data, size_t len);
+
+// end point and bounding box of polyline relative to its start. steps
+void polyline_bounds(const uint8_t *data, size_t len, int32_t *end, int32_t *lo, int32_t *hi);
+
+// pre-calculate junction feeds and acceleration of segments
+void polyline_pre_calculate(polyline_plan *polyline);
+
+// prepare first segment, false if there are no segments
+bool polyline_start(polyline_plan *polyline);
+
+// prepare next segment from pre-calculated data, false if polyline is finished
+bool polyline_next(polyline_plan *polyline);
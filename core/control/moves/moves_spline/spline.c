@@ -0,0 +1,347 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include <control/moves/moves_common/common.h>
+#include <control/moves/moves_common/acceleration.h>
+#include <control/moves/moves_spline/spline.h>
+
+/*
+ * Cubic Bezier curve from 0 to x with control points p1, p2.
+ *
+ * Curve is split to 2^seg_bits segments, so that every segment moves each
+ * axis on not more than 1 step. Position is iterated by forward differences
+ * in 32.32 fixed point, which are resynced with polynomial every
+ * RESYNC_SEGMENTS segments to avoid accumulation of rounding error.
+ */
+
+#define FIX_BITS 32
+#define RESYNC_SEGMENTS 256
+#define LEN_SAMPLES 32
+
+static spline_plan *current_plan;
+
+static struct
+{
+    // polynomial p(u) = ((a u + b) u + c) u
+    double a[3], b[3], c[3];
+
+    // forward differences, fixed point
+    int64_t p[3];
+    int64_t d1[3];
+    int64_t d2[3];
+    int64_t d3[3];
+
+    uint32_t seg;
+    int32_t pos[3];
+    int32_t dir[3];
+    uint8_t stops;
+
+    acceleration_state acc;
+} current_state;
+
+static double param_at(const spline_plan *spline, double len);
+
+static int64_t to_fix(double v)
+{
+    return llround(ldexp(v, FIX_BITS));
+}
+
+static int32_t from_fix(int64_t v)
+{
+    return (int32_t)((v + ((int64_t)1 << (FIX_BITS - 1))) >> FIX_BITS);
+}
+
+static double bezier(int32_t p1, int32_t p2, int32_t x, double u)
+{
+    double v = 1 - u;
+    return 3*v*v*u*p1 + 3*v*u*u*p2 + u*u*u*x;
+}
+
+static void resync(uint32_t seg)
+{
+    int i;
+    double h = ldexp(1, -current_plan->seg_bits);
+    double u = seg * h;
+    for (i = 0; i < 3; i++)
+    {
+        double a = current_state.a[i];
+        double b = current_state.b[i];
+        double c = current_state.c[i];
+        current_state.p[i]  = to_fix(((a*u + b)*u + c)*u);
+        current_state.d1[i] = to_fix(a*(3*u*u*h + 3*u*h*h + h*h*h) + b*(2*u*h + h*h) + c*h);
+        current_state.d2[i] = to_fix(6*a*u*h*h + 6*a*h*h*h + 2*b*h*h);
+        current_state.d3[i] = to_fix(6*a*h*h*h);
+    }
+}
+
+static void iterate(int32_t *delta)
+{
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        current_state.p[i]  += current_state.d1[i];
+        current_state.d1[i] += current_state.d2[i];
+        current_state.d2[i] += current_state.d3[i];
+    }
+
+    current_state.seg++;
+    if (current_state.seg < current_plan->segments && current_state.seg % RESYNC_SEGMENTS == 0)
+        resync(current_state.seg);
+
+    for (i = 0; i < 3; i++)
+    {
+        int32_t pos;
+        if (current_state.seg >= current_plan->segments)
+            pos = current_plan->x[i];
+        else
+            pos = from_fix(current_state.p[i]);
+        delta[i] = pos - current_state.pos[i];
+        current_state.pos[i] = pos;
+    }
+}
+
+// module API functions
+static void update_stops(void)
+{
+    current_state.stops = moves_common_dir_stops(current_plan->stops, current_state.dir[0],
+                                                 current_state.dir[1], current_state.dir[2]);
+}
+
+uint8_t spline_endstops(void)
+{
+    return current_state.stops;
+}
+
+int spline_step_tick(void)
+{
+    int i;
+    int32_t delta[3] = {0, 0, 0};
+    do
+    {
+        if (current_state.seg >= current_plan->segments)
+            return -E_NEXT;
+        iterate(delta);
+    } while (delta[0] == 0 && delta[1] == 0 && delta[2] == 0);
+
+    bool changed = false;
+    for (i = 0; i < 3; i++)
+    {
+        if ((delta[i] > 0 && current_state.dir[i] <= 0) || (delta[i] < 0 && current_state.dir[i] >= 0))
+        {
+            current_state.dir[i] = delta[i];
+            changed = true;
+        }
+        moves_common_schedule_step(i, delta[i]);
+    }
+    if (changed)
+        update_stops();
+    return -E_OK;
+}
+
+double spline_acceleration_process(double len)
+{
+    double dt = len / current_state.acc.feed;
+    acceleration_process(&current_state.acc, dt, current_state.seg);
+    return dt;
+}
+
+double spline_movement_feed(void)
+{
+    return current_state.acc.feed;
+}
+
+// feeds of current move with feed override
+static void override_feeds(void)
+{
+    double feed = moves_common_override_feed(current_plan->feed);
+    double feed1 = moves_common_override_junction(current_plan->feed1);
+    if (feed1 > feed)
+        feed1 = feed;
+
+    acceleration_set_target(&current_state.acc, feed, feed1, current_plan->len);
+    if (current_plan->acceleration > 0)
+    {
+        double dec_len = acceleration(feed1, feed, current_plan->acceleration, current_plan->len, 0, current_plan->len);
+        if (dec_len > current_plan->len)
+            dec_len = current_plan->len;
+        current_state.acc.dec_t = param_at(current_plan, current_plan->len - dec_len) * current_plan->segments;
+    }
+}
+
+void spline_feed_override(void)
+{
+    override_feeds();
+}
+
+int spline_move_to(spline_plan *plan)
+{
+    int i;
+    current_plan = plan;
+    if (!plan->ready)
+    {
+        spline_pre_calculate(plan);
+    }
+
+    if (plan->segments == 0)
+        return -E_NEXT;
+
+    for (i = 0; i < 3; i++)
+    {
+        current_state.a[i] = 3.0*plan->p1[i] - 3.0*plan->p2[i] + plan->x[i];
+        current_state.b[i] = -6.0*plan->p1[i] + 3.0*plan->p2[i];
+        current_state.c[i] = 3.0*plan->p1[i];
+        current_state.pos[i] = 0;
+
+        if (plan->p1[i] != 0)
+            current_state.dir[i] = plan->p1[i];
+        else if (plan->p2[i] != 0)
+            current_state.dir[i] = plan->p2[i];
+        else
+            current_state.dir[i] = plan->x[i];
+    }
+    update_stops();
+    current_state.seg = 0;
+    resync(0);
+
+    current_state.acc.acceleration = plan->acceleration;
+    current_state.acc.feed = plan->feed0;
+    current_state.acc.target_feed = plan->feed;
+    current_state.acc.end_feed = plan->feed1;
+    current_state.acc.type = STATE_ACC;
+
+    current_state.acc.current_t = 0;
+    current_state.acc.start_t   = 0;
+    current_state.acc.end_t     = plan->segments;
+    current_state.acc.acc_t     = plan->acc_steps;
+    current_state.acc.dec_t     = plan->dec_steps;
+    double feed0 = moves_common_start_feed(plan->feed0);
+    if (feed0 != plan->feed0 || moves_common_feed_override() != 1)
+    {
+        current_state.acc.feed = feed0;
+        override_feeds();
+    }
+
+    moves_common_line_started();
+    return -E_OK;
+}
+
+static double sample_len(const spline_plan *spline, double u0, double u1)
+{
+    int i;
+    double l = 0;
+    for (i = 0; i < 3; i++)
+    {
+        double d = bezier(spline->p1[i], spline->p2[i], spline->x[i], u1) -
+                   bezier(spline->p1[i], spline->p2[i], spline->x[i], u0);
+        d /= moves_common_def.steps_per_unit[i];
+        l += d*d;
+    }
+    return sqrt(l);
+}
+
+// Find parameter u, where length of curve from start is len
+static double param_at(const spline_plan *spline, double len)
+{
+    int j;
+    double l = 0;
+    for (j = 0; j < LEN_SAMPLES; j++)
+    {
+        double u0 = (double)j / LEN_SAMPLES;
+        double u1 = (double)(j + 1) / LEN_SAMPLES;
+        double dl = sample_len(spline, u0, u1);
+        if (l + dl >= len)
+        {
+            if (dl <= 0)
+                return u0;
+            return u0 + (u1 - u0) * (len - l) / dl;
+        }
+        l += dl;
+    }
+    return 1;
+}
+
+// max edge of control polygon along one axis. steps
+static uint32_t max_edge(const int32_t *p1, const int32_t *p2, const int32_t *x)
+{
+    int i;
+    uint32_t maxd = 0;
+
+    for (i = 0; i < 3; i++)
+    {
+        uint32_t d1 = labs((long)p1[i]);
+        uint32_t d2 = labs((long)p2[i] - p1[i]);
+        uint32_t d3 = labs((long)x[i] - p2[i]);
+        if (d1 > maxd)
+            maxd = d1;
+        if (d2 > maxd)
+            maxd = d2;
+        if (d3 > maxd)
+            maxd = d3;
+    }
+    return maxd;
+}
+
+bool spline_fits(const int32_t *p1, const int32_t *p2, const int32_t *x)
+{
+    return 3 * (uint64_t)max_edge(p1, p2, x) <= ((uint32_t)1 << SPLINE_MAX_SEG_BITS);
+}
+
+void spline_pre_calculate(spline_plan *spline)
+{
+    int i;
+    uint32_t maxd = max_edge(spline->p1, spline->p2, spline->x);
+
+    spline->ready = 1;
+    if (maxd == 0)
+    {
+        spline->len = 0;
+        spline->segments = 0;
+        return;
+    }
+
+    /* derivative of curve is not more than 3 * max edge of control polygon, longer curves are rejected by planner */
+    spline->seg_bits = 0;
+    while (((uint32_t)1 << spline->seg_bits) < 3 * maxd && spline->seg_bits < SPLINE_MAX_SEG_BITS)
+        spline->seg_bits++;
+    spline->segments = (uint32_t)1 << spline->seg_bits;
+
+    spline->len = 0;
+    for (i = 0; i < LEN_SAMPLES; i++)
+        spline->len += sample_len(spline, (double)i / LEN_SAMPLES, (double)(i + 1) / LEN_SAMPLES);
+
+    if (spline->feed < moves_common_def.feed_base)
+        spline->feed = moves_common_def.feed_base;
+    else if (moves_common_def.feed_max > 0 && spline->feed > moves_common_def.feed_max)
+        spline->feed = moves_common_def.feed_max;
+
+    if (spline->feed1 < moves_common_def.feed_base)
+        spline->feed1 = moves_common_def.feed_base;
+    else if (spline->feed1 > spline->feed)
+        spline->feed1 = spline->feed;
+
+    if (spline->feed0 < moves_common_def.feed_base)
+        spline->feed0 = moves_common_def.feed_base;
+    else if (spline->feed0 > spline->feed)
+        spline->feed0 = spline->feed;
+
+    /* acceleration and deceleration lengths along the curve */
+    double acc_len = 0, dec_len = 0;
+    if (spline->acceleration > 0)
+    {
+        acc_len = acceleration(spline->feed0, spline->feed, spline->acceleration, spline->len, 0, spline->len);
+        dec_len = acceleration(spline->feed1, spline->feed, spline->acceleration, spline->len, 0, spline->len);
+    }
+    if (acc_len + dec_len > spline->len)
+    {
+        double d = (acc_len + dec_len - spline->len) / 2;
+        acc_len -= d;
+        dec_len -= d;
+        if (acc_len < 0)
+            acc_len = 0;
+        if (dec_len < 0)
+            dec_len = 0;
+    }
+
+    spline->acc_steps = param_at(spline, acc_len) * spline->segments;
+    spline->dec_steps = param_at(spline, spline->len - dec_len) * spline->segments;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <control/moves/moves_common/common.h>
+#include <control/moves/moves_common/steppers.h>
+#include <err/err.h>
+
+#define SPLINE_MAX_SEG_BITS 20
+
+typedef struct {
+    // Specified data
+    int32_t p1[3];          // first control point.  steps, relative to start
+    int32_t p2[3];          // second control point. steps, relative to start
+    int32_t x[3];           // end point.            steps, relative to start
+    double feed;            // feed of moving.     mm / sec
+    double feed0;           // initial feed.       mm / sec
+    double feed1;           // finishing feed.     mm / sec
+    double acceleration;    // acceleration mm / sec^2
+    uint8_t stops;          // endstops, which break move. ENDSTOP_*
+
+    // Pre-calculated data
+    double len;             // curve length. mm
+    uint32_t segments;      // amount of forward differencing segments, 2^seg_bits
+    uint32_t acc_steps;     // segment, where acceleration ends
+    uint32_t dec_steps;     // segment, where deceleration begins
+    uint8_t seg_bits;
+    bool ready;             // plan is calculated
+} spline_plan;
+
+// curve can be split to not more than 2^SPLINE_MAX_SEG_BITS segments of 1 step
+bool spline_fits(const int32_t *p1, const int32_t *p2, const int32_t *x);
+
+// pre-calculate parameters of moving
+void spline_pre_calculate(spline_plan *spline);
+
+// init spline moving
+int spline_move_to(spline_plan *plan);
+
+// tick
+int spline_step_tick(void);
+
+double spline_acceleration_process(double len);
+
+double spline_movement_feed(void);
+
+// endstops, which break current move in its current direction
+uint8_t spline_endstops(void);
+
+// apply changed feed override to current move
+void spline_feed_override(void);
@@ -1,4 +1,5 @@
 #include <arc.h>
+#include <assert.h>
 #include <stdio.h>
 
 int32_t pos[3];
@@ -153,9 +154,55 @@ void test_4(void)
 }
 
 
+// bounds are rounded outwards, so they may be 1 step wider
+#define LO(v, e) ((v) <= (e) && (v) >= (e) - 1)
+#define HI(v, e) ((v) >= (e) && (v) <= (e) + 1)
+
+// bounds of arc include extremums between its ends
+void test_bounds(void)
+{
+	int32_t end[3], lo[3], hi[3];
+
+	arc_plan ccw = {
+		.cw = false,
+		.x1 = {1414, -1414},
+		.x2 = {1414, 1414},
+		.a = 2000.0,
+		.b = 2000.0,
+		.plane = XY,
+	};
+
+	/* passes through (2000, 0) */
+	arc_bounds(&ccw, end, lo, hi);
+	printf("ccw: end %i %i %i, lo %i %i %i, hi %i %i %i\n",
+	       end[0], end[1], end[2], lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+	assert(end[0] == 0 && end[1] == 2828 && end[2] == 0);
+	assert(LO(lo[0], 0) && LO(lo[1], 0));
+	assert(HI(hi[0], 586) && HI(hi[1], 2828));
+
+	/* passes through (0, -2000), (-2000, 0) and (0, 2000) */
+	arc_plan cw = ccw;
+	cw.cw = true;
+	arc_bounds(&cw, end, lo, hi);
+	printf("cw: end %i %i %i, lo %i %i %i, hi %i %i %i\n",
+	       end[0], end[1], end[2], lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+	assert(end[0] == 0 && end[1] == 2828 && end[2] == 0);
+	assert(LO(lo[0], -3414) && LO(lo[1], -586));
+	assert(HI(hi[0], 0) && HI(hi[1], 3414));
+
+	/* other plane */
+	cw.plane = YZ;
+	cw.H = 100;
+	arc_bounds(&cw, end, lo, hi);
+	assert(end[0] == 100 && end[1] == 0 && end[2] == 2828);
+	assert(LO(lo[0], 0) && LO(lo[1], -3414) && LO(lo[2], -586));
+	assert(HI(hi[0], 100) && HI(hi[1], 0) && HI(hi[2], 3414));
+}
+
 int main(void)
 {
 	test_4();
+	test_bounds();
 	return 0;
 }
 
@@ -1,5 +1,7 @@
 #include <line.h>
 #include <stdio.h>
+#include <err/err.h>
+#include <assert.h>
 
 int32_t pos[3];
 bool dirs[3];
@@ -141,10 +143,63 @@ void test_4(void)
 	printf("%i\n", time);
 }
 
+/* hold before deceleration, resume after its start, move ramps back to its end feed */
+void test_hold_resume(void)
+{
+	steppers_definition def = {
+		.set_dir = set_dir,
+		.make_step = make_step,
+		.steps_per_unit = {400, 400, 400},
+		.feed_base = 1,
+	};
+
+	moves_common_init(&def);
+	moves_common_reset();
+
+	line_plan plan = {
+		.x = {100*400, 0, 0},
+		.feed = 20,
+		.feed0 = 20,
+		.feed1 = 10,
+		.acceleration = 40,
+		.len = -1, // must be negative at init
+	};
+
+	pos[0] = pos[1] = pos[2] = 0;
+	line_move_to(&plan);
+	double feed = 0;
+	while (line_step_tick() == -E_OK)
+	{
+		double len;
+		moves_common_make_steps(&len);
+		line_acceleration_process(len);
+		if (pos[0] == 30000)
+		{
+			moves_common_set_feed_override(0);
+			line_feed_override();
+		}
+		if (pos[0] == 39000)
+		{
+			moves_common_set_feed_override(1);
+			line_feed_override();
+			feed = line_movement_feed();
+		}
+		if (pos[0] > 39000)
+		{
+			assert(line_movement_feed() - feed < 0.5);
+			feed = line_movement_feed();
+		}
+	}
+
+	printf("exit feed %lf\n", feed);
+	assert(pos[0] == plan.x[0]);
+	assert(feed > 9.9 && feed < 10.1);
+}
 
 int main(void)
 {
 	test_4();
+	test_hold_resume();
 	return 0;
 }
 
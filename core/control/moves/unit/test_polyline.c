@@ -0,0 +1,98 @@
+#include <polyline.h>
+#include <err/err.h>
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+int32_t pos[3];
+bool dirs[3];
+
+void set_dir(int i, bool dir)
+{
+	dirs[i] = dir;
+}
+
+void make_step(int i)
+{
+	if (dirs[i])
+		pos[i]++;
+	else
+		pos[i]--;
+}
+
+static void run(polyline_plan *plan)
+{
+	int32_t x[3] = {0, 0, 0};
+	pos[0] = pos[1] = pos[2] = 0;
+	bool have = polyline_start(plan);
+	while (have)
+	{
+		int i;
+		line_plan check = plan->line;
+		line_pre_calculate(&check);
+		assert(check.steps == plan->line.steps && check.maxi == plan->line.maxi);
+		assert(check.acc_steps == plan->line.acc_steps && check.dec_steps == plan->line.dec_steps);
+		assert(line_move_to(&plan->line) == -E_OK);
+		while (line_step_tick() == -E_OK)
+		{
+			double len;
+			moves_common_make_steps(&len);
+			line_acceleration_process(len);
+		}
+		for (i = 0; i < 3; i++)
+			x[i] += plan->line.x[i];
+		printf("segment %i: %i %i %i, feed0 = %lf, feed1 = %lf\n", plan->cur - 1,
+		       pos[0], pos[1], pos[2], plan->line.feed0, plan->line.feed1);
+		assert(pos[0] == x[0] && pos[1] == x[1] && pos[2] == x[2]);
+		have = polyline_next(plan);
+	}
+}
+
+void test_1(void)
+{
+	steppers_definition def = {
+		.set_dir = set_dir,
+		.make_step = make_step,
+		.steps_per_unit = {100, 100, 100},
+		.feed_base = 1,
+		.feed_max = 100,
+	};
+
+	moves_common_init(&def);
+	moves_common_reset();
+
+	// (100, 0, 0), (100, 100, 0), (0, 0, 0), (200, -100, 0)
+	const uint8_t data[] = {0xc8, 0x01, 0x00, 0x00,
+	                        0xc8, 0x01, 0xc8, 0x01, 0x00,
+	                        0x00, 0x00, 0x00,
+	                        0x90, 0x03, 0xc7, 0x01, 0x00};
+	polyline_segment segments[4];
+	polyline_plan plan = {
+		.feed = 50,
+		.feed0 = 1,
+		.feed1 = 1,
+		.acceleration = 400,
+		.data = data,
+		.data_len = sizeof(data),
+		.count = polyline_count(data, sizeof(data)),
+		.segments = segments,
+	};
+
+	assert(plan.count == 4);
+	assert(polyline_count(data, sizeof(data) - 1) < 0);
+
+	polyline_pre_calculate(&plan);
+	// sharper turn gives lower junction feed
+	assert(segments[0].feed1 < plan.feed);
+	assert(segments[1].feed1 < segments[0].feed1);
+	assert(fabs(segments[3].feed1 - plan.feed1) < 1e-6);
+
+	run(&plan);
+	assert(pos[0] == 400 && pos[1] == 0 && pos[2] == 0);
+}
+
+int main(void)
+{
+	test_1();
+	return 0;
+}
@@ -0,0 +1,92 @@
+#include <spline.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+int32_t pos[3];
+bool dirs[3];
+
+void set_dir(int i, bool dir)
+{
+	dirs[i] = dir;
+}
+
+void make_step(int i)
+{
+	if (dirs[i])
+		pos[i]++;
+	else
+		pos[i]--;
+}
+
+static void run(spline_plan *plan)
+{
+	steppers_definition def = {
+		.set_dir = set_dir,
+		.make_step = make_step,
+		.steps_per_unit = {100, 100, 100},
+		.feed_base = 1,
+		.feed_max = 100,
+	};
+
+	moves_common_init(&def);
+	moves_common_reset();
+
+	pos[0] = pos[1] = pos[2] = 0;
+	assert(spline_move_to(plan) == -E_OK);
+	int ticks = 0;
+	while (spline_step_tick() == -E_OK)
+	{
+		int i;
+		double len;
+		int32_t prev[3] = {pos[0], pos[1], pos[2]};
+		moves_common_make_steps(&len);
+		for (i = 0; i < 3; i++)
+			assert(abs(pos[i] - prev[i]) <= 1);
+		spline_acceleration_process(len);
+		ticks++;
+	}
+	printf("%i %i %i, %i ticks, len = %lf\n", pos[0], pos[1], pos[2], ticks, plan->len);
+	assert(pos[0] == plan->x[0]);
+	assert(pos[1] == plan->x[1]);
+	assert(pos[2] == plan->x[2]);
+}
+
+void test_1(void)
+{
+	spline_plan plan = {
+		.p1 = {1000, 0, 0},
+		.p2 = {2000, 1000, 0},
+		.x = {2000, 2000, 0},
+		.feed = 50,
+		.feed0 = 1,
+		.feed1 = 1,
+		.acceleration = 400,
+	};
+
+	run(&plan);
+	assert(plan.acc_steps > 0);
+	assert(plan.dec_steps < plan.segments);
+}
+
+void test_2(void)
+{
+	spline_plan plan = {
+		.p1 = {-300, 700, 50},
+		.p2 = {900, -1200, 100},
+		.x = {-37, 11, 150},
+		.feed = 20,
+		.feed0 = 1,
+		.feed1 = 1,
+		.acceleration = 100,
+	};
+
+	run(&plan);
+}
+
+int main(void)
+{
+	test_1();
+	test_2();
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include <control/moves/moves_common/common.h>
+#include <control/planner/homing.h>
+#include <err/err.h>
+
+/*
+ * Homing cycle. All selected axes seek their endstops at once with fast
+ * feed, axis is stopped when its endstop is touched, the rest continue.
+ * Then axes move back from endstops and approach them again with slow
+ * feed. Position of homed axes is set to 0 at the latch point.
+ */
+
+static const uint8_t axis_stop[3] = {ENDSTOP_X, ENDSTOP_Y, ENDSTOP_Z};
+
+static void set_move(homing_plan *homing, line_plan *line, const int32_t *x, double feed, uint8_t stops)
+{
+    int i;
+    for (i = 0; i < 3; i++)
+        line->x[i] = x[i];
+    line->feed = feed;
+    line->feed0 = moves_common_def.feed_base;
+    line->feed1 = moves_common_def.feed_base;
+    line->acceleration = homing->acceleration;
+    line->stops = stops;
+    line->len = -1;
+}
+
+// move of axes, which are left in stage, to their endstops
+static void approach(homing_plan *homing, const int32_t *pos, line_plan *line)
+{
+    int i;
+    int32_t x[3] = {0, 0, 0};
+    double feed = homing->seek_feed;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (!(homing->left & axis_stop[i]))
+            continue;
+        if (homing->stage == HOMING_SEEK)
+            x[i] = homing->start[i] - homing->distance[i] - pos[i];
+        else
+            x[i] = homing->start[i] - 2 * homing->backoff - pos[i];
+    }
+    if (homing->stage == HOMING_LATCH)
+        feed = homing->latch_feed;
+    set_move(homing, line, x, feed, homing->left);
+}
+
+static void start_stage(homing_plan *homing, homing_stage stage, const int32_t *pos)
+{
+    int i;
+    homing->stage = stage;
+    homing->left = homing->axes;
+    for (i = 0; i < 3; i++)
+        homing->start[i] = pos[i];
+}
+
+void homing_start(homing_plan *homing, const int32_t *pos, line_plan *line)
+{
+    start_stage(homing, HOMING_SEEK, pos);
+    approach(homing, pos, line);
+}
+
+int homing_next(homing_plan *homing, const int32_t *pos, uint8_t touched, line_plan *line)
+{
+    int i;
+    int32_t x[3] = {0, 0, 0};
+
+    switch (homing->stage)
+    {
+    case HOMING_SEEK:
+    case HOMING_LATCH:
+        touched &= homing->left;
+        if (touched == 0)
+        {
+            /* whole distance is passed without endstop */
+            homing->stage = HOMING_DONE;
+            return -E_ENDSTOP;
+        }
+        homing->left &= ~touched;
+        if (homing->left != 0)
+        {
+            approach(homing, pos, line);
+            return 1;
+        }
+        if (homing->stage == HOMING_LATCH)
+        {
+            int32_t zero[3];
+            for (i = 0; i < 3; i++)
+                zero[i] = (homing->axes & axis_stop[i]) ? 0 : pos[i];
+            moves_common_set_position(zero);
+            homing->stage = HOMING_DONE;
+            return 0;
+        }
+        homing->stage = HOMING_BACKOFF;
+        for (i = 0; i < 3; i++)
+        {
+            if (homing->axes & axis_stop[i])
+                x[i] = homing->backoff;
+        }
+        set_move(homing, line, x, homing->seek_feed, 0);
+        return 1;
+    case HOMING_BACKOFF:
+        start_stage(homing, HOMING_LATCH, pos);
+        approach(homing, pos, line);
+        return 1;
+    case HOMING_DONE:
+    default:
+        return 0;
+    }
+}
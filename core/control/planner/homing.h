@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <control/moves/moves_line/line.h>
+
+typedef enum {
+    HOMING_SEEK = 0,
+    HOMING_BACKOFF,
+    HOMING_LATCH,
+    HOMING_DONE,
+} homing_stage;
+
+typedef struct {
+    // Specified data
+    uint8_t axes;           // homed axes, ENDSTOP_X | ENDSTOP_Y | ENDSTOP_Z
+    int32_t distance[3];    // max seek move to -axis. steps
+    int32_t backoff;        // move from endstops before latch. steps
+    double seek_feed;       // mm / sec
+    double latch_feed;      // mm / sec
+    double acceleration;    // mm / sec^2
+
+    // Running data
+    homing_stage stage;
+    uint8_t left;           // axes, which endstops aren't touched in this stage
+    int32_t start[3];       // position at start of stage. steps
+} homing_plan;
+
+// start cycle from current position and prepare first move to line
+void homing_start(homing_plan *homing, const int32_t *pos, line_plan *line);
+
+// prepare next move after current one is finished, touched - endstops, which have
+// broken it. 1 - next move is prepared, 0 - cycle is finished, < 0 - endstop isn't found
+int homing_next(homing_plan *homing, const int32_t *pos, uint8_t touched, line_plan *line);
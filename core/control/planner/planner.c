@@ -8,12 +8,19 @@
 #include <control/moves/moves.h>
 #include <control/tools/tools.h>
 #include <control/planner/planner.h>
+#include <control/planner/probe_grid.h>
+#include <control/planner/homing.h>
+#include <defs.h>
 #include <err/err.h>
+#include <trace/trace.h>
 
-#ifndef QUEUE_SIZE
-#define QUEUE_SIZE 10
+#ifndef QUEUE_BYTES
+#define QUEUE_BYTES 2048
 #endif
 
+#define MERGE_ANGLE_DEFAULT 0.5       // degrees
+#define MERGE_DEVIATION_DEFAULT 0.005 // mm
+
 extern cnc_position position;
 
 static int last_nid;
@@ -24,43 +31,123 @@ static volatile bool fail_on_endstops = true;
 
 static void (*finish_action)(void);
 static void _planner_lock(void);
+static void get_cmd(void);
 
 typedef enum {
     ACTION_NONE = 0,
     ACTION_LINE,
     ACTION_ARC,
     ACTION_TOOL,
+    ACTION_SPLINE,
+    ACTION_POLYLINE,
+    ACTION_MODBUS,
+    ACTION_RASTER,
+    ACTION_PROBE_GRID,
+    ACTION_HOMING,
 } action_type;
 
 typedef enum {
     STATE_NONE = 0,
-    STATE_QUEUED,
-    STATE_PREPARED,
+    STATE_QUEUED,       // private, planner changes record, moves can't start it
+    STATE_PREPARED,     // published and pre-calculated, moves can start it
     STATE_STARTED,
     STATE_FINISHED,
     STATE_FAILED,
 } action_state;
 
+/* state of prepared move, whose feeds are replaced by feeds slot n of its record */
+#define STATE_FEEDS(n) (((n) + 1) << 4)
+#define STATE_MASK 0x0F
+
+/* feeds of published move with its acceleration pre-calculated for them */
+typedef struct {
+    float feed0;            // mm / sec
+    float feed1;
+    union {
+        uint32_t steps[2];  // acc_steps and dec_steps of line or spline
+        float t[2];         // t_acc and t_dec of arc
+    };
+} plan_feeds;
+
+typedef struct {
+    line_plan line;
+    tool_raster raster;
+} raster_plan;
+
 typedef struct {
     int nid;
-    action_state state;
-    bool state_changed;
+    volatile uint8_t state;     // action_state, changed by ATOMIC_CAS_U8 while record is active
     action_type type;
+    uint16_t size;      // size of record in queue, bytes
+    uint16_t merged;    // amount of next nids merged into this record
+    uint8_t events;     // amount of tool events at the end of record
+    float feed0_req;    // feeds at start and end of move, requested by host. mm / sec
+    float feed1_req;
     union {
-        line_plan line;
-        arc_plan arc;
+        struct {
+            line_plan line;
+            plan_feeds line_feeds[2];
+        };
+        struct {
+            arc_plan arc;
+            plan_feeds arc_feeds[2];
+        };
+        struct {
+            spline_plan spline;
+            plan_feeds spline_feeds[2];
+        };
+        polyline_plan polyline;
         tool_plan tool;
+        modbus_plan modbus;
+        struct {
+            raster_plan raster;
+            plan_feeds raster_feeds[2];
+        };
+        probe_grid_plan probe_grid;
+        homing_plan homing;
     };
 } action_plan;
 
-static action_plan plan[QUEUE_SIZE];
-static int plan_first = 0;
-static int plan_cur = 0;
-static int plan_last = 0;
+/*
+ * Queue is a ring of variable-length records. Each record is a header of
+ * action_plan with only the union member of its type allocated, so tool
+ * toggle takes much less space than helix. Moves, whose feeds are raised
+ * after they are published, have also two feeds slots after the member.
+ * Records are freed in order from the front of the ring.
+ */
+
+#define PLAN_ALIGN offsetof(struct { char c; action_plan p; }, p)
+#define PLAN_ALIGN_UP(n) (((n) + PLAN_ALIGN - 1) / PLAN_ALIGN * PLAN_ALIGN)
+#define PLAN_SIZE(member) PLAN_ALIGN_UP(offsetof(action_plan, member) + sizeof(((action_plan *)0)->member))
+#define PLAN_EVENTS_SIZE(n) PLAN_ALIGN_UP((n) * sizeof(tool_event))
+#define PLAN_MAX_SIZE PLAN_ALIGN_UP(sizeof(action_plan) + PLAN_EVENTS_SIZE(TOOL_EVENTS_MAX))
+
+/*
+ * Every record passes not more than 2 events. Records, whose events
+ * wouldn't fit into FIFO, aren't allocated until reporting frees it.
+ */
+#ifndef PLAN_EVENTS_LEN
+#define PLAN_EVENTS_LEN 32
+#endif
+
+static union {
+    uint8_t bytes[QUEUE_BYTES];
+    action_plan align;
+} plan;
+
+static size_t plan_first = 0;
+static size_t plan_cur = 0;
+static size_t plan_last = 0;
+static size_t plan_wrap = QUEUE_BYTES;   // end of records before wrap to 0
+static size_t plan_tail = 0;             // last queued record
 
 static int active_plan_len = 0;
 static int plan_len = 0;
 
+/* private records at the tail, which moves can't start yet */
+static size_t private_pos = 0;
+static int private_len = 0;
+
 static bool break_on_probe = false;
 
 static void (*ev_send_started)(int nid);
@@ -69,87 +156,600 @@ static void (*ev_send_completed_with_pos)(int nid, const int32_t *pos);
 static void (*ev_send_queued)(int nid);
 static void (*ev_send_dropped)(int nid);
 static void (*ev_send_failed)(int nid);
+static void (*ev_send_probed)(int nid, int index, const int32_t *values, int n);
+
+/* position, where probe has been touched, is reported with completion */
+static volatile int probe_nid = -1;
+static int32_t probe_pos[3];
+
+/*
+ * State changes of records are passed to reporting by FIFO in the order
+ * they happen. It is written by moves (mostly from ISR) and read by
+ * planner_report_states(). Events keep nids, so events of records dropped
+ * by lock are still reported. Records are counted by epoch of queue, which
+ * is changed by lock, and only events of current epoch pop records.
+ */
+typedef struct {
+    int nid;
+    uint16_t merged;
+    uint8_t state;
+    uint8_t probed : 1;     // completion is reported with probe_pos
+    uint8_t epoch : 7;
+} plan_event;
+
+static volatile plan_event events[PLAN_EVENTS_LEN];
+static volatile uint16_t events_head;   // written by moves
+static volatile uint16_t events_tail;   // written by reporting
+static volatile uint16_t events_epoch;  // first event of current epoch
+static uint8_t plan_epoch;
+static void (*events_notify)(void);
+
+#define STOPS_DEFAULT (-1)    // endstops of G-code moves
+
+/* current move of running probing or homing cycle */
+static line_plan cycle_line;
+
+/* probing cycle is stopped, until its results are reported */
+static volatile bool probe_waiting = false;
+
+/* tool events for next queued line or arc */
+static tool_event pending_events[TOOL_EVENTS_MAX];
+static uint8_t pending_events_len = 0;
+
+/* soft limits of machine envelope, moves are checked when queued */
+static bool soft_limits = false;
+static int32_t limits_lo[3];
+static int32_t limits_hi[3];
+static int32_t plan_pos[3];              // position at end of queued moves. steps
+
+/* axes, whose position is set by homing cycle and isn't lost since. ENDSTOP_* */
+static volatile uint8_t homed = 0;
+
+/* exit feed of the last queued move. mm / sec */
+static double tail_exit;
+
+/* spline or polyline at the end of queue, which stops only while it is the last one */
+static bool exit_open = false;
+static size_t exit_pos;
+static double exit_feed = 0;            // raised exit of published spline at exit_pos, 0 - none
+
+/* replanned moves after the last barrier of queue, not more than REPLAN_DEPTH. positions */
+#define REPLAN_DEPTH 8
+static size_t replan_window[REPLAN_DEPTH];
+static int replan_len = 0;
+
+static double merge_cos = 0;
+static double merge_deviation = 0;       // max deviation of merged vertices. mm
+static double tail_deviation = 0;        // deviation of vertices merged into tail. mm
+
+static action_plan *plan_at(size_t pos)
+{
+    return (action_plan *)(plan.bytes + pos);
+}
+
+// Tool events are placed after union member of the record
+static tool_event *plan_events(action_plan *p)
+{
+    return (tool_event *)((uint8_t *)p + p->size - PLAN_EVENTS_SIZE(p->events));
+}
+
+static size_t plan_next(size_t pos)
+{
+    pos += plan_at(pos)->size;
+    if (pos >= plan_wrap)
+        pos = 0;
+    return pos;
+}
+
+static void plan_reset(void)
+{
+    plan_first = plan_cur = plan_last = 0;
+    plan_wrap = QUEUE_BYTES;
+    plan_len = 0;
+    active_plan_len = 0;
+    private_len = 0;
+    exit_open = false;
+    exit_feed = 0;
+    replan_len = 0;
+    probe_waiting = false;
+    plan_epoch++;
+    events_epoch = events_head;
+}
+
+static int events_pending(void)
+{
+    return (events_head + PLAN_EVENTS_LEN - events_tail) % PLAN_EVENTS_LEN;
+}
+
+// Events of previous epochs, which aren't reported yet. Other ones belong to queued records
+static int events_stale(void)
+{
+    int stale = (events_epoch + PLAN_EVENTS_LEN - events_tail) % PLAN_EVENTS_LEN;
+    int pending = events_pending();
+    return stale <= pending ? stale : 0;
+}
+
+static void push_event(const action_plan *p, action_state state)
+{
+    uint16_t head = events_head;
+    volatile plan_event *ev = &events[head];
+    ev->nid = p->nid;
+    ev->merged = p->merged;
+    ev->state = state;
+    ev->probed = (state == STATE_FINISHED && p->nid == probe_nid);
+    ev->epoch = plan_epoch & 0x7F;
+    if (ev->probed)
+        probe_nid = -1;
+    events_head = (head + 1) % PLAN_EVENTS_LEN;
+    if (events_notify)
+        events_notify();
+}
+
+static void set_state(action_plan *p, action_state state)
+{
+    p->state = state;
+    push_event(p, state);
+}
+
+/*
+ * Moves (from ISR) can reach any published record at any moment, because
+ * tool, modbus and empty records are passed without waiting, and moves
+ * never wait for planner. So new records are private (QUEUED) at the tail,
+ * where planner changes them freely, and moves stop before them. They are
+ * pre-calculated and published together, and the first of them is
+ * published the last, so moves see all of them PREPARED at once. The last
+ * published move exits with base feed, moves can always stop there.
+ *
+ * Published records aren't changed. Raised feeds of published move are
+ * written to free feeds slot of its record, and the slot is published by
+ * compare and swap of record state. Moves claim record for start by swap
+ * of its state to STARTED, so the slot is either taken by moves with the
+ * claim, or isn't published at all.
+ */
+static plan_feeds *plan_slots(action_plan *p)
+{
+    switch (p->type)
+    {
+    case ACTION_LINE:
+        return p->line_feeds;
+    case ACTION_RASTER:
+        return p->raster_feeds;
+    case ACTION_SPLINE:
+        return p->spline_feeds;
+    default:
+        return p->arc_feeds;
+    }
+}
+
+// Moves take published feeds of claimed record
+static void use_feeds(action_plan *p, const plan_feeds *f)
+{
+    switch (p->type)
+    {
+    case ACTION_LINE:
+    case ACTION_RASTER:
+    {
+        line_plan *line = (p->type == ACTION_LINE) ? &(p->line) : &(p->raster.line);
+        line->feed0 = f->feed0;
+        line->feed1 = f->feed1;
+        line->acc_steps = f->steps[0];
+        line->dec_steps = f->steps[1];
+        break;
+    }
+    case ACTION_SPLINE:
+        p->spline.feed0 = f->feed0;
+        p->spline.feed1 = f->feed1;
+        p->spline.acc_steps = f->steps[0];
+        p->spline.dec_steps = f->steps[1];
+        break;
+    default:
+        p->arc.feed0 = f->feed0;
+        p->arc.feed1 = f->feed1;
+        p->arc.t_acc = f->t[0];
+        p->arc.t_dec = f->t[1];
+        break;
+    }
+}
+
+// Moves claim published record for start, false if it is private or already started
+static bool plan_claim_start(action_plan *p)
+{
+    uint8_t state = p->state;
+    while ((state & STATE_MASK) == STATE_PREPARED)
+    {
+        if (ATOMIC_CAS_U8(&p->state, &state, STATE_STARTED))
+        {
+            if (state != STATE_PREPARED)
+                use_feeds(p, &plan_slots(p)[(state >> 4) - 1]);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Feeds, which moves start record with
+static void move_feeds(action_plan *p, double *feed0, double *feed1)
+{
+    uint8_t state = p->state;
+    if ((state & STATE_MASK) == STATE_PREPARED && state != STATE_PREPARED)
+    {
+        plan_feeds *f = &plan_slots(p)[(state >> 4) - 1];
+        *feed0 = f->feed0;
+        *feed1 = f->feed1;
+        return;
+    }
+    switch (p->type)
+    {
+    case ACTION_LINE:
+        *feed0 = p->line.feed0;
+        *feed1 = p->line.feed1;
+        break;
+    case ACTION_RASTER:
+        *feed0 = p->raster.line.feed0;
+        *feed1 = p->raster.line.feed1;
+        break;
+    case ACTION_SPLINE:
+        *feed0 = p->spline.feed0;
+        *feed1 = p->spline.feed1;
+        break;
+    default:
+        *feed0 = p->arc.feed0;
+        *feed1 = p->arc.feed1;
+        break;
+    }
+}
+
+// Pre-calculate copy of published move with other feeds
+static void calc_feeds(action_plan *p, double feed0, double feed1, plan_feeds *f)
+{
+    switch (p->type)
+    {
+    case ACTION_LINE:
+    case ACTION_RASTER:
+    {
+        line_plan line = (p->type == ACTION_LINE) ? p->line : p->raster.line;
+        line.feed0 = feed0;
+        line.feed1 = feed1;
+        line_pre_calculate(&line);
+        f->feed0 = line.feed0;
+        f->feed1 = line.feed1;
+        f->steps[0] = line.acc_steps;
+        f->steps[1] = line.dec_steps;
+        break;
+    }
+    case ACTION_SPLINE:
+    {
+        spline_plan spline = p->spline;
+        spline.feed0 = feed0;
+        spline.feed1 = feed1;
+        spline_pre_calculate(&spline);
+        f->feed0 = spline.feed0;
+        f->feed1 = spline.feed1;
+        f->steps[0] = spline.acc_steps;
+        f->steps[1] = spline.dec_steps;
+        break;
+    }
+    default:
+    {
+        arc_plan arc = p->arc;
+        arc.feed0 = feed0;
+        arc.feed1 = feed1;
+        arc_pre_calculate(&arc);
+        f->feed0 = arc.feed0;
+        f->feed1 = arc.feed1;
+        f->t[0] = arc.t_acc;
+        f->t[1] = arc.t_dec;
+        break;
+    }
+    }
+}
+
+// Publish new feeds of prepared move, false if moves have started it
+static bool plan_swap_feeds(action_plan *p, double feed0, double feed1)
+{
+    uint8_t state = p->state;
+    double cur0, cur1;
+    int n;
+
+    if ((state & STATE_MASK) != STATE_PREPARED)
+        return false;
+    move_feeds(p, &cur0, &cur1);
+    if ((float)feed0 == (float)cur0 && (float)feed1 == (float)cur1)
+        return true;
+
+    /* slot, which isn't published now */
+    n = (state == (STATE_PREPARED | STATE_FEEDS(0))) ? 1 : 0;
+    calc_feeds(p, (float)feed0, (float)feed1, &plan_slots(p)[n]);
+    return ATOMIC_CAS_U8(&p->state, &state, STATE_PREPARED | STATE_FEEDS(n));
+}
+
+// Allocate record of specified size at the end of queue
+static action_plan *plan_alloc(size_t size)
+{
+    size_t pos;
+
+    /* every record passes not more than 2 events, FIFO must not overflow */
+    if (events_stale() + 2 * (plan_len + 1) >= PLAN_EVENTS_LEN)
+        return NULL;
+
+    if (plan_len == 0)
+        plan_reset();
+
+    if (plan_len > 0 && plan_last < plan_first)
+    {
+        if (plan_first - plan_last < size)
+            return NULL;
+        pos = plan_last;
+    }
+    else if (plan_len > 0 && plan_last == plan_first)
+    {
+        return NULL;
+    }
+    else if (QUEUE_BYTES - plan_last >= size)
+    {
+        pos = plan_last;
+    }
+    else
+    {
+        if (plan_first < size)
+            return NULL;
+        if (active_plan_len == 0)
+            plan_cur = 0;
+        plan_wrap = plan_last;
+        pos = 0;
+    }
+
+    plan_last = pos + size;
+    if (plan_last >= plan_wrap)
+        plan_last = 0;
+
+    action_plan *cur = plan_at(pos);
+    cur->size = size;
+    cur->merged = 0;
+    cur->events = 0;
+    plan_tail = pos;
+    tail_deviation = 0;
+    return cur;
+}
+
+// Allocate record with pending tool events
+static action_plan *plan_alloc_events(size_t size)
+{
+    action_plan *cur = plan_alloc(size + PLAN_EVENTS_SIZE(pending_events_len));
+    if (cur == NULL)
+        return NULL;
+    cur->events = pending_events_len;
+    memcpy(plan_events(cur), pending_events, pending_events_len * sizeof(tool_event));
+    pending_events_len = 0;
+    return cur;
+}
 
 static void next_cmd(void)
 {
     if (active_plan_len > 0)
     {
-        plan_cur = (plan_cur + 1) % QUEUE_SIZE;
+        plan_cur = plan_next(plan_cur);
 	active_plan_len--;
     }
 }
 
+/*
+ * Moves pass record before its event is pushed, because reporting pops
+ * finished record, and position of the next one depends on wrap of queue
+ */
+static void finish_cmd(action_plan *cp)
+{
+    next_cmd();
+    set_state(cp, STATE_FINISHED);
+}
+
 static void pop_cmd(void)
 {
     if (plan_len > 0)
     {
-        memset(&plan[plan_first], 0, sizeof(action_plan));
-        plan[plan_first].state = STATE_NONE;
+        size_t next = plan_next(plan_first);
+        plan_at(plan_first)->state = STATE_NONE;
+        if (exit_pos == plan_first)
+        {
+            exit_open = false;
+            exit_feed = 0;
+        }
+        if (replan_len > 0 && replan_window[0] == plan_first)
+        {
+            replan_len--;
+            memmove(replan_window, replan_window + 1, replan_len * sizeof(replan_window[0]));
+        }
+        if (next < plan_first)
+            plan_wrap = QUEUE_BYTES;
 
-        plan_first = (plan_first + 1) % QUEUE_SIZE;
+        plan_first = next;
         plan_len--;
     }
 }
 
+// Send results of probing grid by batches, all - send also incomplete batch
+static void report_probe_grid(action_plan *p, bool all)
+{
+    probe_grid_plan *grid = &(p->probe_grid);
+    for (;;)
+    {
+        int32_t values[PROBE_GRID_BATCH];
+        int n = 0;
+        uint16_t tail = grid->results_tail;
+        uint16_t head = grid->results_head;
+        uint16_t len = (head + PROBE_GRID_RESULTS - tail) % PROBE_GRID_RESULTS;
+        if (len == 0 || (len < PROBE_GRID_BATCH && !all))
+            return;
+        while (n < PROBE_GRID_BATCH && tail != head)
+        {
+            values[n++] = grid->results[tail];
+            tail = (tail + 1) % PROBE_GRID_RESULTS;
+        }
+        grid->results_tail = tail;
+        ev_send_probed(p->nid, grid->reported, values, n);
+        grid->reported += n;
+    }
+}
+
+// Continue probing cycle, which waits for room of results. Moves are stopped meanwhile
+static void resume_probe_grid(action_plan *p)
+{
+    probe_waiting = false;
+    if (probe_grid_next(&(p->probe_grid), position.pos, false, &cycle_line))
+    {
+        moves_line_to(&cycle_line);
+        return;
+    }
+    if (p->probe_grid.stage == PROBE_GRID_WAIT)
+    {
+        probe_waiting = true;
+        return;
+    }
+    finish_cmd(p);
+    get_cmd();
+}
+
 void planner_report_states(void)
 {
-    int id;
-    for (id = 0; id < QUEUE_SIZE; id++)
+    int j;
+
+    TRACE_SCOPE("planner_report_states");
+
+    while (events_tail != events_head)
     {
-        action_plan *p = &plan[id];
-	if (p->state == STATE_NONE)
-            continue;
-        if (!p->state_changed)
-            continue;
-	switch (p->state)
+        uint16_t tail = events_tail;
+        volatile plan_event *ev = &events[tail];
+        int nid = ev->nid;
+        int merged = ev->merged;
+        bool current = (ev->epoch == (plan_epoch & 0x7F));
+
+        switch (ev->state)
         {
         case STATE_STARTED:
-            ev_send_started(p->nid);
+            for (j = 0; j <= merged; j++)
+                ev_send_started(nid + j);
             break;
         case STATE_FAILED:
-            ev_send_failed(p->nid);
-            pop_cmd();
+            for (j = 0; j <= merged; j++)
+                ev_send_failed(nid + j);
             break;
         case STATE_FINISHED:
-            ev_send_completed(p->nid);
-            pop_cmd();
+            /* finished record is the first one in queue */
+            if (current && plan_len > 0 && plan_at(plan_first)->type == ACTION_PROBE_GRID)
+                report_probe_grid(plan_at(plan_first), true);
+            for (j = 0; j <= merged; j++)
+            {
+                if (j == merged && ev->probed)
+                    ev_send_completed_with_pos(nid + j, probe_pos);
+                else
+                    ev_send_completed(nid + j);
+            }
+            if (current)
+                pop_cmd();
+            break;
+        default:
             break;
         }
-        p->state_changed = false;
+        events_tail = (tail + 1) % PLAN_EVENTS_LEN;
     }
+
+    /* results of running probing cycle are reported by batches */
+    if (active_plan_len > 0)
+    {
+        action_plan *p = plan_at(plan_cur);
+        if (p->type == ACTION_PROBE_GRID && p->state == STATE_STARTED)
+        {
+            report_probe_grid(p, false);
+            if (probe_waiting)
+                resume_probe_grid(p);
+        }
+    }
+}
+
+void planner_set_events_notify(void (*notify)(void))
+{
+    events_notify = notify;
 }
 
 static void get_cmd(void)
 {
+    TRACE_SCOPE("get_cmd");
     if (active_plan_len == 0)
     {
     	return;
     }
 
-    action_plan *cp = &plan[plan_cur];
+    action_plan *cp = plan_at(plan_cur);
     int res;
 
-    cp->state = STATE_STARTED;
-    cp->state_changed = true;
+    if (!plan_claim_start(cp))
+        return;
+    push_event(cp, STATE_STARTED);
 
     switch (cp->type) {
     case ACTION_LINE:
+        moves_set_tool_events(plan_events(cp), cp->events);
         res = moves_line_to(&(cp->line));
         if (res == -E_NEXT)
         {
-            cp->state = STATE_FINISHED;
-            cp->state_changed = true;
-            next_cmd();
+            finish_cmd(cp);
             get_cmd();
         }
         break;
     case ACTION_ARC:
+        moves_set_tool_events(plan_events(cp), cp->events);
         res = moves_arc_to(&(cp->arc));
         if (res == -E_NEXT)
         {
-            cp->state = STATE_FINISHED;
-            cp->state_changed = true;
-            next_cmd();
+            finish_cmd(cp);
+            get_cmd();
+        }
+        break;
+    case ACTION_PROBE_GRID:
+        if (probe_grid_start(&(cp->probe_grid), position.pos, &cycle_line))
+            res = moves_line_to(&cycle_line);
+        else
+            res = -E_NEXT;
+        if (res == -E_NEXT)
+        {
+            finish_cmd(cp);
+            get_cmd();
+        }
+        break;
+    case ACTION_HOMING:
+        homing_start(&(cp->homing), position.pos, &cycle_line);
+        res = moves_line_to(&cycle_line);
+        if (res == -E_NEXT)
+        {
+            finish_cmd(cp);
+            get_cmd();
+        }
+        break;
+    case ACTION_RASTER:
+        moves_set_tool_raster(&(cp->raster.raster));
+        res = moves_line_to(&(cp->raster.line));
+        if (res == -E_NEXT)
+        {
+            finish_cmd(cp);
+            get_cmd();
+        }
+        break;
+    case ACTION_SPLINE:
+        res = moves_spline_to(&(cp->spline));
+        if (res == -E_NEXT)
+        {
+            finish_cmd(cp);
+            get_cmd();
+        }
+        break;
+    case ACTION_POLYLINE:
+        if (polyline_start(&(cp->polyline)))
+            res = moves_line_to(&(cp->polyline.line));
+        else
+            res = -E_NEXT;
+        if (res == -E_NEXT)
+        {
+            finish_cmd(cp);
             get_cmd();
         }
         break;
@@ -157,16 +757,20 @@ static void get_cmd(void)
         res = tool_action(&(cp->tool));
         if (res == -E_NEXT)
         {
-            cp->state = STATE_FINISHED;
-            cp->state_changed = true;
-            next_cmd();
+            finish_cmd(cp);
+            get_cmd();
+        }
+        break;
+    case ACTION_MODBUS:
+        res = modbus_action(&(cp->modbus));
+        if (res == -E_NEXT)
+        {
+            finish_cmd(cp);
             get_cmd();
         }
         break;
     case ACTION_NONE:
-        cp->state = STATE_FINISHED;
-        cp->state_changed = true;
-        next_cmd();
+        finish_cmd(cp);
         get_cmd();
         break;
     }
@@ -178,18 +782,78 @@ static void (*line_error_cb)(void);
 
 static void line_started(void)
 {
+    TRACE_SCOPE("line_started");
     if (locked)
         return;
     line_started_cb();
 }
 
-static void line_finished(void)
+static void move_failed(void)
 {
-    action_plan *cp = &plan[plan_cur];
-    cp->state = STATE_FINISHED;
-    cp->state_changed = true;
-    line_finished_cb();
+    action_plan *cp = plan_at(plan_cur);
+    set_state(cp, STATE_FAILED);
+    _planner_lock();
+    line_error_cb();
     next_cmd();
+}
+
+// touched - endstops, which have broken move
+static void move_finished(uint8_t touched)
+{
+    action_plan *cp = plan_at(plan_cur);
+
+    /* lock stops moves, when their records are already dropped */
+    if (active_plan_len == 0)
+    {
+        line_finished_cb();
+        return;
+    }
+
+    /* continue polyline with next segment */
+    if (!locked && cp->type == ACTION_POLYLINE && polyline_next(&(cp->polyline)))
+    {
+        line_finished_cb();
+        moves_line_to(&(cp->polyline.line));
+        return;
+    }
+
+    /* continue probing cycle with next move */
+    if (!locked && cp->type == ACTION_PROBE_GRID &&
+        probe_grid_next(&(cp->probe_grid), position.pos, (touched & ENDSTOP_PROBE) != 0, &cycle_line))
+    {
+        line_finished_cb();
+        moves_line_to(&cycle_line);
+        return;
+    }
+
+    /* probing cycle doesn't drop results, it waits until they are reported */
+    if (!locked && cp->type == ACTION_PROBE_GRID && cp->probe_grid.stage == PROBE_GRID_WAIT)
+    {
+        line_finished_cb();
+        probe_waiting = true;
+        return;
+    }
+
+    /* continue homing with next move */
+    if (!locked && cp->type == ACTION_HOMING)
+    {
+        int res = homing_next(&(cp->homing), position.pos, touched, &cycle_line);
+        if (res < 0)
+        {
+            move_failed();
+            return;
+        }
+        if (res > 0)
+        {
+            line_finished_cb();
+            moves_line_to(&cycle_line);
+            return;
+        }
+        homed |= cp->homing.axes;
+    }
+
+    line_finished_cb();
+    finish_cmd(cp);
 
     if (locked)
         return;
@@ -197,20 +861,37 @@ static void line_finished(void)
     get_cmd();
 }
 
+static void line_finished(void)
+{
+    TRACE_SCOPE("line_finished");
+    move_finished(0);
+}
+
 static void endstops_touched(void)
 {
+    /* steps of touching tick aren't made, so position is exact */
+    uint8_t touched = moves_touched_endstops();
+    bool probed = (touched & ENDSTOP_PROBE) != 0;
+    action_type type = plan_at(plan_cur)->type;
+    if (probed)
+        memcpy(probe_pos, position.pos, sizeof(probe_pos));
+
+    /* touch of probe is a normal part of probing cycle, and touch of endstop - of homing */
+    if ((probed && type == ACTION_PROBE_GRID) || type == ACTION_HOMING)
+    {
+        move_finished(touched);
+        return;
+    }
+
     if (!fail_on_endstops)
     {
+        if (probed)
+            probe_nid = plan_at(plan_cur)->nid;
         line_finished();
     }
     else
     {
-        action_plan *cp = &plan[plan_cur];
-	_planner_lock();
-	cp->state = STATE_FAILED;
-	cp->state_changed = true;
-        line_error_cb();
-        next_cmd();
+        move_failed();
     }
 }
 
@@ -224,7 +905,8 @@ void init_planner(steppers_definition *def,
                   void (*arg_send_completed)(int nid),
                   void (*arg_send_completed_with_pos)(int nid, const int32_t *pos),
                   void (*arg_send_dropped)(int nid),
-                  void (*arg_send_failed)(int nid))
+                  void (*arg_send_failed)(int nid),
+                  void (*arg_send_probed)(int nid, int index, const int32_t *values, int n))
 {
     ev_send_started = arg_send_started;
     ev_send_completed = arg_send_completed;
@@ -232,11 +914,14 @@ void init_planner(steppers_definition *def,
     ev_send_queued = arg_send_queued;
     ev_send_dropped = arg_send_dropped;
     ev_send_failed = arg_send_failed;
-    plan_cur = plan_last = 0;
-    plan_len = 0;
-    active_plan_len = 0;
+    ev_send_probed = arg_send_probed;
+    events_tail = events_head;
+    plan_reset();
+    pending_events_len = 0;
+    planner_set_merge(MERGE_ANGLE_DEFAULT, MERGE_DEVIATION_DEFAULT);
     search_begin = 0;
     finish_action = NULL;
+    homed = 0;
 
     memcpy(&steppers_definitions, def, sizeof(*def));
     memcpy(&gpio_definitions, gd, sizeof(*gd));
@@ -263,37 +948,476 @@ int used_slots(void)
     return plan_len;
 }
 
+// Amount of moves of the largest type, which still can be queued
+static int empty_bytes_slots(void)
+{
+    if (plan_len == 0)
+        return QUEUE_BYTES / PLAN_MAX_SIZE;
+    if (plan_last < plan_first)
+        return (plan_first - plan_last) / PLAN_MAX_SIZE;
+    if (plan_last == plan_first)
+        return 0;
+    return (QUEUE_BYTES - plan_last) / PLAN_MAX_SIZE + plan_first / PLAN_MAX_SIZE;
+}
+
 int empty_slots(void)
 {
-    return QUEUE_SIZE - used_slots() - 1;
+    int slots = empty_bytes_slots();
+    int events = (PLAN_EVENTS_LEN - 1 - events_stale()) / 2 - plan_len;
+    if (events < 0)
+        events = 0;
+    return slots < events ? slots : events;
 }
 
-static int break_on_endstops(int32_t *dx, void *user_data)
+// Endstops, which break G-code moves. Soft limits keep homed axes inside of envelope
+static uint8_t default_stops(void)
 {
-    cnc_endstops endstops = steppers_definitions.get_endstops();
-    if (endstops.stop_x && dx[0] < 0)
-        return 1;
+    return (ENDSTOPS_AXES & ~(soft_limits ? homed : 0)) | (break_on_probe ? ENDSTOP_PROBE : 0);
+}
 
-    if (endstops.stop_y && dx[1] < 0)
-        return 1;
+// without queued moves end of queue is the real position
+static void plan_pos_sync(void)
+{
+    if (active_plan_len == 0)
+        memcpy(plan_pos, position.pos, sizeof(plan_pos));
+}
 
-    if (endstops.stop_z && dx[2] < 0)
-        return 1;
+static void plan_pos_move(const int32_t *x)
+{
+    int i;
+    plan_pos_sync();
+    for (i = 0; i < 3; i++)
+        plan_pos[i] += x[i];
+}
 
-    if (break_on_probe && endstops.probe && dx[2] >= 0)
-        return 1;
+// bounding box of move from end of queue, relative to it, must be inside of soft limits
+static bool in_limits(const int32_t *lo, const int32_t *hi)
+{
+    int i;
+    if (!soft_limits)
+        return true;
+    plan_pos_sync();
+    for (i = 0; i < 3; i++)
+    {
+        if (plan_pos[i] + lo[i] < limits_lo[i] || plan_pos[i] + hi[i] > limits_hi[i])
+            return false;
+    }
+    return true;
+}
 
-    return 0;
+static void line_bounds(const int32_t *x, int32_t *lo, int32_t *hi)
+{
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        lo[i] = x[i] < 0 ? x[i] : 0;
+        hi[i] = x[i] > 0 ? x[i] : 0;
+    }
 }
 
-static int _planner_line_to(int32_t x[3], int (*cbr)(int32_t *, void *), void *usr_data,
-                            double feed, double f0, double f1, int32_t acc, int nid)
+void planner_set_soft_limits(bool enable, const int32_t *lo, const int32_t *hi)
 {
-    action_plan *cur;
+    soft_limits = enable;
+    if (enable)
+    {
+        memcpy(limits_lo, lo, sizeof(limits_lo));
+        memcpy(limits_hi, hi, sizeof(limits_hi));
+    }
+}
 
-    if (x[0] == 0 && x[1] == 0 && x[2] == 0)
+void planner_set_merge(double angle, double deviation)
+{
+    merge_cos = cos(angle * M_PI / 180);
+    merge_deviation = deviation;
+}
+
+/*
+ * Host can be late with next moves, so the last queued move always ends
+ * with base feed, and junction feeds before it are lowered, so the
+ * machine can stop within queued moves. Next queued move raises them back
+ * to requested ones. Private moves are changed in place, published ones
+ * by their feeds slots, from the tail to the front, and moves which are
+ * already started keep their feeds. Splines, polylines and cycles aren't
+ * replanned, moves before them are kept, only exit of spline or polyline
+ * at the end of queue is raised by next move. Polyline is raised only
+ * while it is private.
+ */
+
+/* private records are published, when moves are not more than PUBLISH_DEPTH records before them */
+#define PUBLISH_DEPTH 4
+
+static line_plan *replanned_line(action_plan *p)
+{
+    switch (p->type)
+    {
+    case ACTION_LINE:
+        return &(p->line);
+    case ACTION_RASTER:
+        return &(p->raster.line);
+    default:
+        return NULL;
+    }
+}
+
+static bool is_replanned(action_plan *p)
+{
+    return replanned_line(p) != NULL || p->type == ACTION_ARC;
+}
+
+static bool is_barrier(const action_plan *p)
+{
+    switch (p->type)
+    {
+    case ACTION_SPLINE:
+    case ACTION_POLYLINE:
+    case ACTION_PROBE_GRID:
+    case ACTION_HOMING:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// New record enters window of replanned moves, or barrier empties it
+static void window_push(action_plan *p, size_t pos)
+{
+    if (is_barrier(p))
+    {
+        replan_len = 0;
+        return;
+    }
+    if (!is_replanned(p))
+        return;
+    if (replan_len == REPLAN_DEPTH)
+    {
+        replan_len--;
+        memmove(replan_window, replan_window + 1, replan_len * sizeof(replan_window[0]));
+    }
+    replan_window[replan_len++] = pos;
+}
+
+// max feed on one end of move, which allows to have feed on other end
+static double feed_limit(action_plan *p, double feed)
+{
+    double len = 0, acc;
+    line_plan *line = replanned_line(p);
+    if (line != NULL)
+    {
+        int i;
+        for (i = 0; i < 3; i++)
+        {
+            double d = line->x[i] / moves_common_def.steps_per_unit[i];
+            len += d * d;
+        }
+        len = sqrt(len);
+        acc = line->acceleration;
+    }
+    else
+    {
+        len = p->arc.len;
+        acc = p->arc.acceleration;
+    }
+    if (acc <= 0)
+        return INFINITY;
+    return sqrt(feed * feed + 2 * acc * len);
+}
+
+static double max_feed(action_plan *p)
+{
+    line_plan *line = replanned_line(p);
+    return line != NULL ? line->feed : p->arc.feed;
+}
+
+// Feeds of private move, it is pre-calculated when published
+static void set_feeds(action_plan *p, double feed0, double feed1)
+{
+    line_plan *line = replanned_line(p);
+    if (line != NULL)
+    {
+        line->feed0 = (float)feed0;
+        line->feed1 = (float)feed1;
+    }
+    else
+    {
+        p->arc.feed0 = (float)feed0;
+        p->arc.feed1 = (float)feed1;
+    }
+}
+
+// Spline or polyline, which is not the last move any more, exits with entry feed of next move
+static void raise_exit(double feed)
+{
+    action_plan *p = plan_at(exit_pos);
+
+    if (!exit_open)
+        return;
+    exit_open = false;
+    if (p->state != STATE_QUEUED)
+    {
+        /* published spline is raised by its slot, when next move is published too */
+        if (p->type == ACTION_SPLINE)
+            exit_feed = feed;
+        return;
+    }
+    if (p->type == ACTION_SPLINE)
+        p->spline.feed1 = feed;
+    else
+        p->polyline.feed1 = feed;
+}
+
+// new record becomes the last move
+static void queue_move(action_plan *p, double f0, double f1)
+{
+    double base = moves_common_def.feed_base;
+    double entry = (active_plan_len == 0) ? base : tail_exit;
+
+    p->feed0_req = f0;
+    p->feed1_req = f1;
+    switch (p->type)
+    {
+    case ACTION_LINE:
+    case ACTION_RASTER:
+    case ACTION_ARC:
+        entry = fmax(fmin(fmin(f0, entry), feed_limit(p, base)), base);
+        set_feeds(p, entry, base);
+        tail_exit = base;
+        break;
+    case ACTION_SPLINE:
+        entry = fmin(f0, entry);
+        p->spline.feed0 = entry;
+        p->spline.feed1 = base;
+        tail_exit = fmin(f1, p->spline.feed);
+        break;
+    case ACTION_POLYLINE:
+        entry = fmin(f0, entry);
+        p->polyline.feed0 = entry;
+        p->polyline.feed1 = base;
+        tail_exit = fmin(f1, p->polyline.feed);
+        break;
+    default:
+        /* cycles stop after each move */
+        entry = base;
+        tail_exit = base;
+        break;
+    }
+    raise_exit(entry);
+    if (p->type == ACTION_SPLINE || p->type == ACTION_POLYLINE)
+    {
+        exit_open = true;
+        exit_pos = plan_tail;
+    }
+}
+
+static void replan(void)
+{
+    const size_t *window = replan_window;
+    double v[REPLAN_DEPTH + 1];
+    double base = moves_common_def.feed_base;
+    double feed0;
+    int i, n = replan_len, cut = -1;
+
+    if (n == 0)
+        return;
+
+    /* the last published move exits with base feed, while records after it are private */
+    for (i = 0; i < n && private_len > 0; i++)
+    {
+        if (plan_at(window[i])->state != STATE_QUEUED)
+            cut = i;
+    }
+
+    /* the last move stops, junctions before it are limited by deceleration */
+    v[n] = base;
+    for (i = n - 1; i > 0; i--)
+    {
+        action_plan *p = plan_at(window[i]);
+        action_plan *prev = plan_at(window[i - 1]);
+        double junction = fmin(fmin(prev->feed1_req, p->feed0_req), fmin(max_feed(prev), max_feed(p)));
+        double exit = (i == cut) ? base : v[i + 1];
+        v[i] = fmax(fmin(junction, feed_limit(p, exit)), base);
+    }
+
+    /* start of the first one is fixed by move before it, so acceleration limits junctions too */
+    move_feeds(plan_at(window[0]), &v[0], &feed0);
+    for (i = 0; i < n; i++)
+    {
+        action_plan *p = plan_at(window[i]);
+        uint8_t state = p->state & STATE_MASK;
+        if (state != STATE_QUEUED && state != STATE_PREPARED)
+        {
+            /* started move keeps its exit */
+            move_feeds(p, &feed0, &v[i + 1]);
+            continue;
+        }
+        v[i + 1] = fmin(v[i + 1], feed_limit(p, v[i]));
+    }
+
+    /*
+     * Moves start records in order, so exit of published move is raised
+     * only after entry of the next one, and moves never pass junction
+     * with exit higher than entry of next move.
+     */
+    for (i = n - 1; i >= 0; i--)
+    {
+        action_plan *p = plan_at(window[i]);
+        if (p->state == STATE_QUEUED)
+            set_feeds(p, v[i], v[i + 1]);
+        else if (!plan_swap_feeds(p, v[i], (i == cut) ? base : v[i + 1]))
+            break;
+    }
+}
+
+// Pre-calculate private record, before it is published
+static void plan_prepare(action_plan *p)
+{
+    switch (p->type)
+    {
+    case ACTION_LINE:
+        line_pre_calculate(&(p->line));
+        break;
+    case ACTION_ARC:
+        arc_pre_calculate(&(p->arc));
+        break;
+    case ACTION_RASTER:
+        line_pre_calculate(&(p->raster.line));
+        break;
+    case ACTION_SPLINE:
+        spline_pre_calculate(&(p->spline));
+        break;
+    case ACTION_POLYLINE:
+        polyline_pre_calculate(&(p->polyline));
+        break;
+    default:
+        break;
+    }
+}
+
+// Publish all private records at once, and start them if moves are stopped
+static void plan_publish(void)
+{
+    size_t pos = private_pos;
+    uint8_t queued = STATE_QUEUED;
+    int i;
+
+    if (private_len == 0)
+        return;
+
+    /* private moves are planned in place */
+    replan();
+
+    /* moves can't pass the first private record, so it is published the last */
+    for (i = 0; i < private_len; i++, pos = plan_next(pos))
+    {
+        action_plan *p = plan_at(pos);
+        plan_prepare(p);
+        if (i > 0)
+            p->state = STATE_PREPARED;
+    }
+    private_len = 0;
+    ATOMIC_CAS_U8(&(plan_at(private_pos)->state), &queued, STATE_PREPARED);
+
+    /* published moves before them don't stop any more */
+    replan();
+    if (exit_feed > 0)
+    {
+        double feed0, feed1;
+        action_plan *p = plan_at(exit_pos);
+        move_feeds(p, &feed0, &feed1);
+        plan_swap_feeds(p, feed0, exit_feed);
+        exit_feed = 0;
+    }
+    get_cmd();
+}
+
+// Count new record at the tail. It is private, unless moves have nothing else to start
+static void plan_push(action_plan *cur)
+{
+    if (private_len == 0)
+        private_pos = plan_tail;
+    private_len++;
+    cur->state = STATE_QUEUED;
+    plan_len++;
+    active_plan_len++;
+    window_push(cur, plan_tail);
+    if (active_plan_len == private_len)
+        plan_publish();
+    else
+        replan();
+}
+
+/*
+ * Line, which continues last queued line with the same feed, and doesn't
+ * turn more than on merge angle, extends that line instead of taking new
+ * record. Deviation of all merged vertices from the resulting line is kept
+ * within merge_deviation. Merged nids must follow each other, they are
+ * reported together with nid of record.
+ *
+ * Only private record is extended, so the move being extended can't be
+ * started meanwhile.
+ */
+static bool merge_line(int32_t x[3], double feed, double f1, int32_t acc, int nid)
+{
+    int i;
+    double a[3], b[3], e[3];
+    double la = 0, lb = 0, le = 0, ab = 0;
+
+    if (merge_deviation <= 0 || active_plan_len == 0 || pending_events_len > 0)
+        return false;
+
+    action_plan *p = plan_at(plan_tail);
+    if (p->type != ACTION_LINE || p->line.stops != default_stops() || p->events > 0)
+        return false;
+    if (p->state != STATE_QUEUED)
+        return false;
+    if (nid != p->nid + p->merged + 1 || p->merged == UINT16_MAX)
+        return false;
+    if (p->line.feed != feed || p->line.acceleration != acc)
+        return false;
+
+    for (i = 0; i < 3; i++)
+    {
+        a[i] = p->line.x[i] / moves_common_def.steps_per_unit[i];
+        b[i] = x[i] / moves_common_def.steps_per_unit[i];
+        e[i] = a[i] + b[i];
+        la += a[i] * a[i];
+        lb += b[i] * b[i];
+        le += e[i] * e[i];
+        ab += a[i] * b[i];
+    }
+    if (ab < merge_cos * sqrt(la * lb))
+        return false;
+
+    /* distance from junction vertex to new line */
+    double cx = a[1] * e[2] - a[2] * e[1];
+    double cy = a[2] * e[0] - a[0] * e[2];
+    double cz = a[0] * e[1] - a[1] * e[0];
+    double dev = sqrt((cx * cx + cy * cy + cz * cz) / le);
+    if (tail_deviation + dev > merge_deviation)
+        return false;
+
+    tail_deviation += dev;
+    for (i = 0; i < 3; i++)
+        p->line.x[i] += x[i];
+    p->feed1_req = f1;
+    p->merged++;
+    plan_pos_move(x);
+    replan();
+    return true;
+}
+
+static int _planner_line_to(int32_t x[3], int stops,
+                            double feed, double f0, double f1, int32_t acc, int nid)
+{
+    action_plan *cur;
+    int32_t lo[3], hi[3];
+
+    if (x[0] == 0 && x[1] == 0 && x[2] == 0)
         return 0;
 
+    line_bounds(x, lo, hi);
+    if (stops == STOPS_DEFAULT && !in_limits(lo, hi))
+        return -E_LIMITS;
+
     if (f0 < steppers_definitions.feed_base)
         f0 = steppers_definitions.feed_base;
 
@@ -303,19 +1427,18 @@ static int _planner_line_to(int32_t x[3], int (*cbr)(int32_t *, void *), void *u
     if (feed < steppers_definitions.feed_base)
         feed = steppers_definitions.feed_base;
 
-    cur = &plan[plan_last];
+    if (stops == STOPS_DEFAULT && merge_line(x, feed, f1, acc, nid))
+        return 1;
+
+    if (stops == STOPS_DEFAULT)
+        cur = plan_alloc_events(PLAN_SIZE(line_feeds));
+    else
+        cur = plan_alloc(PLAN_SIZE(line_feeds));
+    if (cur == NULL)
+        return -E_NOMEM;
     cur->type = ACTION_LINE;
     cur->nid = nid;
-    if (cbr != NULL)
-    {
-        cur->line.check_break = cbr;
-        cur->line.check_break_data = usr_data;
-    }
-    else
-    {
-        cur->line.check_break = break_on_endstops;
-        cur->line.check_break_data = x;
-    }
+    cur->line.stops = (stops == STOPS_DEFAULT) ? default_stops() : stops;
     cur->line.x[0] = x[0];
     cur->line.x[1] = x[1];
     cur->line.x[2] = x[2];
@@ -326,13 +1449,10 @@ static int _planner_line_to(int32_t x[3], int (*cbr)(int32_t *, void *), void *u
     cur->line.len = -1;
     cur->line.acc_steps = -1;
     cur->line.dec_steps = -1;
+    queue_move(cur, f0, f1);
 
-    plan_last = (plan_last + 1) % QUEUE_SIZE;
-    plan_len++;
-    active_plan_len++;
-
-    cur->state = STATE_QUEUED;
-    cur->state_changed = false;
+    plan_pos_move(x);
+    plan_push(cur);
     return 1;
 }
 
@@ -343,18 +1463,14 @@ int planner_line_to(int32_t x[3], double feed, double f0, double f1, int32_t acc
         return -E_LOCKED;
     }
 
-    if (empty_slots() == 0)
+    int res = _planner_line_to(x, STOPS_DEFAULT, feed, f0, f1, acc, nid);
+    if (res < 0)
     {
-        return -E_NOMEM;
+        return res;
     }
-
-    int res = _planner_line_to(x, NULL, NULL, feed, f0, f1, acc, nid);
-    if (res)
+    else if (res)
     {
         ev_send_queued(nid);
-        if (active_slots() == 1) {
-            get_cmd();
-        }
     }
     else
     {
@@ -365,15 +1481,237 @@ int planner_line_to(int32_t x[3], double feed, double f0, double f1, int32_t acc
     return empty_slots();
 }
 
+int planner_raster_to(int32_t x[3], const uint8_t *data, size_t len, int bits, int pitch, int tool,
+                      double feed, double f0, double f1, int32_t acc, int nid)
+{
+    action_plan *cur;
+    size_t size;
+    int32_t lo[3], hi[3];
+
+    if (planner_is_locked())
+    {
+        return -E_LOCKED;
+    }
+
+    if ((bits != 1 && bits != 2 && bits != 4 && bits != 8) || pitch <= 0 || pitch > UINT16_MAX ||
+        len * 8 / bits > UINT16_MAX || tool < 0 || tool >= TOOLS_MAX)
+    {
+        return -E_INCORRECT;
+    }
+
+    if (x[0] == 0 && x[1] == 0 && x[2] == 0)
+    {
+        ev_send_dropped(nid);
+        last_nid = nid;
+        return empty_slots();
+    }
+
+    line_bounds(x, lo, hi);
+    if (!in_limits(lo, hi))
+        return -E_LIMITS;
+
+    size = PLAN_ALIGN_UP(PLAN_SIZE(raster_feeds) + len);
+    if (size > QUEUE_BYTES || size > UINT16_MAX)
+        return -E_NOMEM;
+
+    if (f0 < steppers_definitions.feed_base)
+        f0 = steppers_definitions.feed_base;
+
+    if (f1 < steppers_definitions.feed_base)
+        f1 = steppers_definitions.feed_base;
+
+    if (feed < steppers_definitions.feed_base)
+        feed = steppers_definitions.feed_base;
+
+    cur = plan_alloc(size);
+    if (cur == NULL)
+        return -E_NOMEM;
+    cur->type = ACTION_RASTER;
+    cur->nid = nid;
+
+    cur->raster.line.stops = default_stops();
+    cur->raster.line.x[0] = x[0];
+    cur->raster.line.x[1] = x[1];
+    cur->raster.line.x[2] = x[2];
+    cur->raster.line.feed = feed;
+    cur->raster.line.feed0 = f0;
+    cur->raster.line.feed1 = f1;
+    cur->raster.line.acceleration = acc;
+    cur->raster.line.len = -1;
+    cur->raster.line.acc_steps = -1;
+    cur->raster.line.dec_steps = -1;
+
+    /* pixels are placed after feeds slots in record */
+    uint8_t *tail = (uint8_t *)cur + PLAN_SIZE(raster_feeds);
+    memcpy(tail, data, len);
+    cur->raster.raster.data = tail;
+    cur->raster.raster.pixels = len * 8 / bits;
+    cur->raster.raster.pitch = pitch;
+    cur->raster.raster.bits = bits;
+    cur->raster.raster.id = tool;
+    queue_move(cur, f0, f1);
+
+    plan_pos_move(x);
+    plan_push(cur);
+
+    ev_send_queued(nid);
+    last_nid = nid;
+    return empty_slots();
+}
+
+int planner_probe_grid(int32_t offset[2], int32_t pitch[2], int count[2], int32_t depth, int32_t retract,
+                       int repeats, double probe_feed, double travel_feed, int32_t acc, int nid)
+{
+    action_plan *cur;
+    int32_t lo[3], hi[3];
+    int i;
+
+    if (planner_is_locked())
+    {
+        return -E_LOCKED;
+    }
+
+    if (count[0] <= 0 || count[1] <= 0 || count[0] > UINT16_MAX || count[1] > UINT16_MAX ||
+        (int32_t)count[0] * count[1] > UINT16_MAX ||
+        depth <= 0 || retract < 0 || repeats < 1 || repeats > PROBE_GRID_REPEATS_MAX)
+    {
+        return -E_INCORRECT;
+    }
+
+    /* cycle returns to start, so only its box is checked */
+    for (i = 0; i < 2; i++)
+    {
+        int32_t last = offset[i] + (count[i] - 1) * pitch[i];
+        lo[i] = offset[i] < last ? offset[i] : last;
+        hi[i] = offset[i] < last ? last : offset[i];
+        if (lo[i] > 0)
+            lo[i] = 0;
+        if (hi[i] < 0)
+            hi[i] = 0;
+    }
+    lo[2] = 0;
+    hi[2] = depth;
+    if (!in_limits(lo, hi))
+        return -E_LIMITS;
+
+    if (probe_feed < steppers_definitions.feed_base)
+        probe_feed = steppers_definitions.feed_base;
+
+    if (travel_feed < steppers_definitions.feed_base)
+        travel_feed = steppers_definitions.feed_base;
+
+    cur = plan_alloc(PLAN_SIZE(probe_grid));
+    if (cur == NULL)
+        return -E_NOMEM;
+    cur->type = ACTION_PROBE_GRID;
+    cur->nid = nid;
+
+    probe_grid_plan *grid = &(cur->probe_grid);
+    grid->offset[0] = offset[0];
+    grid->offset[1] = offset[1];
+    grid->pitch[0] = pitch[0];
+    grid->pitch[1] = pitch[1];
+    grid->count[0] = count[0];
+    grid->count[1] = count[1];
+    grid->depth = depth;
+    grid->retract = retract;
+    grid->repeats = repeats;
+    grid->probe_feed = probe_feed;
+    grid->travel_feed = travel_feed;
+    grid->acceleration = acc;
+    grid->stops = ENDSTOPS_AXES | ENDSTOP_PROBE;
+    grid->results_head = grid->results_tail = 0;
+    queue_move(cur, steppers_definitions.feed_base, steppers_definitions.feed_base);
+
+    plan_push(cur);
+
+    ev_send_queued(nid);
+    last_nid = nid;
+    return empty_slots();
+}
+
+int planner_homing(int32_t distance[3], int32_t backoff, double seek_feed, double latch_feed,
+                   int32_t acc, int nid)
+{
+    static const uint8_t axis_stop[3] = {ENDSTOP_X, ENDSTOP_Y, ENDSTOP_Z};
+    action_plan *cur;
+    uint8_t axes = 0;
+    int i;
+
+    if (planner_is_locked())
+    {
+        return -E_LOCKED;
+    }
+
+    for (i = 0; i < 3; i++)
+    {
+        if (distance[i] < 0)
+            return -E_INCORRECT;
+        if (distance[i] > 0)
+            axes |= axis_stop[i];
+    }
+    if (axes == 0 || backoff <= 0)
+        return -E_INCORRECT;
+
+    if (seek_feed < steppers_definitions.feed_base)
+        seek_feed = steppers_definitions.feed_base;
+
+    if (latch_feed < steppers_definitions.feed_base)
+        latch_feed = steppers_definitions.feed_base;
+
+    cur = plan_alloc(PLAN_SIZE(homing));
+    if (cur == NULL)
+        return -E_NOMEM;
+    cur->type = ACTION_HOMING;
+    cur->nid = nid;
+
+    homing_plan *homing = &(cur->homing);
+    homing->axes = axes;
+    for (i = 0; i < 3; i++)
+        homing->distance[i] = distance[i];
+    homing->backoff = backoff;
+    homing->seek_feed = seek_feed;
+    homing->latch_feed = latch_feed;
+    homing->acceleration = acc;
+    queue_move(cur, steppers_definitions.feed_base, steppers_definitions.feed_base);
+
+    /* homed axes are at 0 after cycle */
+    plan_pos_sync();
+    for (i = 0; i < 3; i++)
+    {
+        if (axes & axis_stop[i])
+            plan_pos[i] = 0;
+    }
+    plan_push(cur);
+
+    ev_send_queued(nid);
+    last_nid = nid;
+    return empty_slots();
+}
+
 static int _planner_arc_to(int32_t x1[2], int32_t x2[2], int32_t H, double len, double a, double b, arc_plane plane, int cw,
-			   int (*cbr)(int32_t *, void *), void *usr_data,
+			   int stops,
                            double feed, double f0, double f1, int32_t acc, int nid)
 {
     action_plan *cur;
+    int32_t end[3], lo[3], hi[3];
 
     if (x1[0] == x2[0] && x1[1] == x2[1])
         return 0;
 
+    arc_plan bounds = {
+        .plane = plane,
+        .x1 = {x1[0], x1[1]},
+        .x2 = {x2[0], x2[1]},
+        .H = H,
+        .a = a,
+        .b = b,
+        .cw = cw,
+    };
+    arc_bounds(&bounds, end, lo, hi);
+    if (stops == STOPS_DEFAULT && !in_limits(lo, hi))
+        return -E_LIMITS;
+
     if (f0 < steppers_definitions.feed_base)
         f0 = steppers_definitions.feed_base;
 
@@ -383,19 +1721,15 @@ static int _planner_arc_to(int32_t x1[2], int32_t x2[2], int32_t H, double len,
     if (feed < steppers_definitions.feed_base)
         feed = steppers_definitions.feed_base;
 
-    cur = &plan[plan_last];
+    if (stops == STOPS_DEFAULT)
+        cur = plan_alloc_events(PLAN_SIZE(arc_feeds));
+    else
+        cur = plan_alloc(PLAN_SIZE(arc_feeds));
+    if (cur == NULL)
+        return -E_NOMEM;
     cur->type = ACTION_ARC;
     cur->nid = nid;
-    if (cbr != NULL)
-    {
-        cur->arc.check_break = cbr;
-        cur->arc.check_break_data = usr_data;
-    }
-    else
-    {
-        cur->arc.check_break = break_on_endstops;
-        cur->arc.check_break_data = NULL;
-    }
+    cur->arc.stops = (stops == STOPS_DEFAULT) ? default_stops() : stops;
     cur->arc.H = H;
     cur->arc.x1[0] = x1[0];
     cur->arc.x1[1] = x1[1];
@@ -412,13 +1746,10 @@ static int _planner_arc_to(int32_t x1[2], int32_t x2[2], int32_t H, double len,
     cur->arc.feed1 = f1;
     cur->arc.acceleration = acc;
     cur->arc.ready = 0;
+    queue_move(cur, f0, f1);
 
-    plan_last = (plan_last + 1) % QUEUE_SIZE;
-    plan_len++;
-    active_plan_len++;
-
-    cur->state = STATE_QUEUED;
-    cur->state_changed = false;
+    plan_pos_move(end);
+    plan_push(cur);
     return 1;
 }
 
@@ -431,18 +1762,14 @@ int planner_arc_to(int32_t x1[2], int32_t x2[2], int32_t H, double len, double a
         return -E_LOCKED;
     }
 
-    if (empty_slots() == 0)
+    int res = _planner_arc_to(x1, x2, H, len, a, b, plane, cw, STOPS_DEFAULT, feed, f0, f1, acc, nid);
+    if (res < 0)
     {
-        return -E_NOMEM;
+        return res;
     }
-
-    int res = _planner_arc_to(x1, x2, H, len, a, b, plane, cw, NULL, NULL, feed, f0, f1, acc, nid);
-    if (res)
+    else if (res)
     {
         ev_send_queued(nid);
-        if (active_slots() == 1) {
-            get_cmd();
-        }
     }
     else
     {
@@ -453,43 +1780,262 @@ int planner_arc_to(int32_t x1[2], int32_t x2[2], int32_t H, double len, double a
     return empty_slots();
 }
 
-int planner_tool(int id, bool on, int nid)
+static int _planner_spline_to(int32_t p1[3], int32_t p2[3], int32_t x[3],
+                              int stops,
+                              double feed, double f0, double f1, int32_t acc, int nid)
+{
+    action_plan *cur;
+    int32_t lo[3], hi[3];
+    int i;
+
+    if (x[0] == 0 && x[1] == 0 && x[2] == 0 &&
+        p1[0] == 0 && p1[1] == 0 && p1[2] == 0 &&
+        p2[0] == 0 && p2[1] == 0 && p2[2] == 0)
+        return 0;
+
+    if (!spline_fits(p1, p2, x))
+        return -E_INCORRECT;
+
+    /* spline is inside of convex hull of its control points */
+    line_bounds(x, lo, hi);
+    for (i = 0; i < 3; i++)
+    {
+        int32_t pmin = p1[i] < p2[i] ? p1[i] : p2[i];
+        int32_t pmax = p1[i] < p2[i] ? p2[i] : p1[i];
+        if (pmin < lo[i])
+            lo[i] = pmin;
+        if (pmax > hi[i])
+            hi[i] = pmax;
+    }
+    if (stops == STOPS_DEFAULT && !in_limits(lo, hi))
+        return -E_LIMITS;
+
+    if (f0 < steppers_definitions.feed_base)
+        f0 = steppers_definitions.feed_base;
+
+    if (f1 < steppers_definitions.feed_base)
+        f1 = steppers_definitions.feed_base;
+
+    if (feed < steppers_definitions.feed_base)
+        feed = steppers_definitions.feed_base;
+
+    cur = plan_alloc(PLAN_SIZE(spline_feeds));
+    if (cur == NULL)
+        return -E_NOMEM;
+    cur->type = ACTION_SPLINE;
+    cur->nid = nid;
+    cur->spline.stops = (stops == STOPS_DEFAULT) ? default_stops() : stops;
+    for (i = 0; i < 3; i++)
+    {
+        cur->spline.p1[i] = p1[i];
+        cur->spline.p2[i] = p2[i];
+        cur->spline.x[i] = x[i];
+    }
+    cur->spline.feed = feed;
+    cur->spline.feed0 = f0;
+    cur->spline.feed1 = f1;
+    cur->spline.acceleration = acc;
+    cur->spline.ready = 0;
+    queue_move(cur, f0, f1);
+
+    plan_pos_move(x);
+    plan_push(cur);
+    return 1;
+}
+
+int planner_spline_to(int32_t p1[3], int32_t p2[3], int32_t x[3],
+                      double feed, double f0, double f1, int32_t acc, int nid)
 {
     if (planner_is_locked())
     {
         return -E_LOCKED;
     }
 
-    if (empty_slots() == 0)
+    int res = _planner_spline_to(p1, p2, x, STOPS_DEFAULT, feed, f0, f1, acc, nid);
+    if (res < 0)
+    {
+        return res;
+    }
+    else if (res)
+    {
+        ev_send_queued(nid);
+    }
+    else
     {
+        ev_send_dropped(nid);
+    }
+
+    last_nid = nid;
+    return empty_slots();
+}
+
+static int _planner_polyline_to(const uint8_t *data, size_t len,
+                                int stops,
+                                double feed, double f0, double f1, int32_t acc, int nid)
+{
+    action_plan *cur;
+    ssize_t count = polyline_count(data, len);
+    size_t segments_size, size;
+    int32_t end[3], lo[3], hi[3];
+
+    if (count < 0)
+        return -E_INCORRECT;
+    if (count == 0)
+        return 0;
+
+    polyline_bounds(data, len, end, lo, hi);
+    if (stops == STOPS_DEFAULT && !in_limits(lo, hi))
+        return -E_LIMITS;
+
+    segments_size = PLAN_ALIGN_UP(count * sizeof(polyline_segment));
+    size = PLAN_ALIGN_UP(PLAN_SIZE(polyline) + segments_size + len);
+    if (size > QUEUE_BYTES || size > UINT16_MAX)
         return -E_NOMEM;
+
+    if (f0 < steppers_definitions.feed_base)
+        f0 = steppers_definitions.feed_base;
+
+    if (f1 < steppers_definitions.feed_base)
+        f1 = steppers_definitions.feed_base;
+
+    if (feed < steppers_definitions.feed_base)
+        feed = steppers_definitions.feed_base;
+
+    cur = plan_alloc(size);
+    if (cur == NULL)
+        return -E_NOMEM;
+    cur->type = ACTION_POLYLINE;
+    cur->nid = nid;
+    cur->polyline.stops = (stops == STOPS_DEFAULT) ? default_stops() : stops;
+
+    /* segments and packed data are placed after polyline plan in record */
+    uint8_t *tail = (uint8_t *)cur + PLAN_SIZE(polyline);
+    cur->polyline.segments = (polyline_segment *)tail;
+    memcpy(tail + segments_size, data, len);
+    cur->polyline.data = tail + segments_size;
+    cur->polyline.data_len = len;
+    cur->polyline.count = count;
+
+    cur->polyline.feed = feed;
+    cur->polyline.feed0 = f0;
+    cur->polyline.feed1 = f1;
+    cur->polyline.acceleration = acc;
+    cur->polyline.ready = false;
+    queue_move(cur, f0, f1);
+
+    plan_pos_move(end);
+    plan_push(cur);
+    return 1;
+}
+
+int planner_polyline_to(const uint8_t *data, size_t len,
+                        double feed, double f0, double f1, int32_t acc, int nid)
+{
+    if (planner_is_locked())
+    {
+        return -E_LOCKED;
+    }
+
+    int res = _planner_polyline_to(data, len, STOPS_DEFAULT, feed, f0, f1, acc, nid);
+    if (res < 0)
+    {
+        return res;
+    }
+    else if (res)
+    {
+        ev_send_queued(nid);
+    }
+    else
+    {
+        ev_send_dropped(nid);
+    }
+
+    last_nid = nid;
+    return empty_slots();
+}
+
+int planner_tool(int id, bool on, double power, int nid)
+{
+    if (planner_is_locked())
+    {
+        return -E_LOCKED;
     }
 
     action_plan *cur;
 
-    cur = &plan[plan_last];
+    cur = plan_alloc(PLAN_SIZE(tool));
+    if (cur == NULL)
+    {
+        return -E_NOMEM;
+    }
     cur->type = ACTION_TOOL;
     cur->nid = nid;
 
     cur->tool.on = on;
     cur->tool.id = id;
+    cur->tool.power = power;
 
-    plan_last = (plan_last + 1) % QUEUE_SIZE;
-    plan_len++;
-    active_plan_len++;
+    plan_push(cur);
 
     ev_send_queued(nid);
     last_nid = nid;
+    return empty_slots();
+}
 
-    cur->state = STATE_QUEUED;
-    cur->state_changed = false;
+int planner_modbus_write(int device, int reg, int value, int nid)
+{
+    if (planner_is_locked())
+    {
+        return -E_LOCKED;
+    }
 
-    if (active_slots() == 1) {
-        get_cmd();
+    action_plan *cur;
+
+    cur = plan_alloc(PLAN_SIZE(modbus));
+    if (cur == NULL)
+    {
+        return -E_NOMEM;
     }
+    cur->type = ACTION_MODBUS;
+    cur->nid = nid;
+
+    cur->modbus.device = device;
+    cur->modbus.reg = reg;
+    cur->modbus.value = value;
+
+    plan_push(cur);
+
+    ev_send_queued(nid);
+    last_nid = nid;
     return empty_slots();
 }
 
+int planner_tool_event(int id, bool on, uint32_t step)
+{
+    if (planner_is_locked())
+    {
+        return -E_LOCKED;
+    }
+
+    int i = pending_events_len;
+    if (i >= TOOL_EVENTS_MAX)
+    {
+        return -E_NOMEM;
+    }
+
+    /* keep events sorted by step */
+    while (i > 0 && pending_events[i - 1].step > step)
+    {
+        pending_events[i] = pending_events[i - 1];
+        i--;
+    }
+    pending_events[i].step = step;
+    pending_events[i].id = id;
+    pending_events[i].on = on;
+    pending_events_len++;
+    return TOOL_EVENTS_MAX - pending_events_len;
+}
+
 static int srx, sry, srz;
 
 void enable_break_on_probe(bool en)
@@ -499,41 +2045,21 @@ void enable_break_on_probe(bool en)
 
 void planner_pre_calculate(void)
 {
-    int i;
-    for (i = 0; i < active_slots(); i++)
-    {
-        int pos = (plan_cur + i) % QUEUE_SIZE;
-        action_plan *p = &plan[pos];
-        switch(p->type)
-        {
-            case ACTION_LINE:
-                if (p->state == STATE_QUEUED)
-                {
-                    line_pre_calculate(&(p->line));
-		    p->state = STATE_PREPARED;
-		    p->state_changed = true;
-                }
-                break;
-            case ACTION_ARC:
-                if (p->state == STATE_QUEUED)
-                {
-                    arc_pre_calculate(&(p->arc));
-		    p->state = STATE_PREPARED;
-		    p->state_changed = true;
-                }
-                break;
-            default:
-                break;
-        }
-    }
+    TRACE_SCOPE("planner_pre_calculate");
+
+    /* private records wait for merging, while moves are far from them */
+    if (private_len > 0 && active_plan_len - private_len <= PUBLISH_DEPTH)
+        plan_publish();
 }
 
 static void _planner_lock(void)
 {
+    /* broken moves may lose steps */
+    if (active_plan_len > 0)
+        homed = 0;
     locked = 1;
-    plan_cur = plan_last = 0;
-    plan_len = 0;
-    active_plan_len = 0;
+    pending_events_len = 0;
+    plan_reset();
     moves_break();
 }
 
@@ -557,6 +2083,12 @@ int planner_is_locked(void)
     return locked;
 }
 
+void planner_set_position(const int32_t *x)
+{
+    moves_common_set_position(x);
+    homed = 0;
+}
+
 void planner_fail_on_endstops(bool fail)
 {
     fail_on_endstops = fail;
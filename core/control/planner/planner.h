@@ -7,6 +7,8 @@
 #include <control/tools/tools.h>
 #include <control/moves/moves_line/line.h>
 #include <control/moves/moves_arc/arc.h>
+#include <control/moves/moves_spline/spline.h>
+#include <control/moves/moves_polyline/polyline.h>
 
 int empty_slots(void);
 
@@ -17,17 +19,52 @@ void init_planner(steppers_definition *pd,
                   void (*arg_send_completed)(int nid),
                   void (*arg_send_completed_with_pos)(int nid, const int32_t *pos),
                   void (*arg_send_dropped)(int nid),
-		  void (*arg_send_failed)(int nid));
+		  void (*arg_send_failed)(int nid),
+                  void (*arg_send_probed)(int nid, int index, const int32_t *values, int n));
 
 int planner_line_to(int32_t x[3], double feed, double f0, double f1, int32_t acc, int nid);
 
 int planner_arc_to(int32_t x1[2], int32_t x2[2], int32_t H, double len, double a, double b, arc_plane plane, int cw,
 		   double feed, double f0, double f1, int32_t acc, int nid);
 
-int planner_tool(int id, bool on, int nid);
+int planner_spline_to(int32_t p1[3], int32_t p2[3], int32_t x[3],
+                      double feed, double f0, double f1, int32_t acc, int nid);
+
+int planner_polyline_to(const uint8_t *data, size_t len,
+                        double feed, double f0, double f1, int32_t acc, int nid);
+
+// power > 0 - PWM mode, duty is power at target feed and decreases with feed
+int planner_tool(int id, bool on, double power, int nid);
+
+// line with power levels of tool, one pixel of bits size per pitch steps of the longest axis
+int planner_raster_to(int32_t x[3], const uint8_t *data, size_t len, int bits, int pitch, int tool,
+                      double feed, double f0, double f1, int32_t acc, int nid);
+
+// switch tool on specified tick of next queued line or arc
+int planner_tool_event(int id, bool on, uint32_t step);
+
+// probing cycle: grid of count points from offset with pitch, relative to current position. Steps
+// Probe moves to +Z not more than depth, point is probed repeats times with retract between
+int planner_probe_grid(int32_t offset[2], int32_t pitch[2], int count[2], int32_t depth, int32_t retract,
+                       int repeats, double probe_feed, double travel_feed, int32_t acc, int nid);
+
+// homing cycle: axes with distance > 0 seek endstops not further than distance, move back on
+// backoff and approach endstops again with latch feed. Position of homed axes is set to 0. Steps
+int planner_homing(int32_t distance[3], int32_t backoff, double seek_feed, double latch_feed,
+                   int32_t acc, int nid);
+
+// write modbus register, when queue reaches this command
+int planner_modbus_write(int device, int reg, int value, int nid);
 
 void planner_pre_calculate(void);
 
+// angle in degrees, deviation in mm. Zero deviation disables merging of lines
+void planner_set_merge(double angle, double deviation);
+
+// moves, which leave lo..hi box of machine position, are rejected when queued. Steps
+// Endstops of axes homed by G28 don't break G-code moves while soft limits are enabled
+void planner_set_soft_limits(bool enable, const int32_t *lo, const int32_t *hi);
+
 void enable_break_on_probe(bool en);
 
 void planner_unlock(void);
@@ -38,5 +75,11 @@ int planner_is_locked(void);
 
 void planner_fail_on_endstops(bool fail);
 
+// set machine position without homing, axes aren't counted as homed any more. Steps
+void planner_set_position(const int32_t *x);
+
 void planner_report_states(void);
 
+// notify is called when states of moves are ready to be reported, it may be called from ISR
+void planner_set_events_notify(void (*notify)(void));
+
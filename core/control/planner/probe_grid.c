@@ -0,0 +1,164 @@
+#include <control/moves/moves_common/common.h>
+#include <control/planner/probe_grid.h>
+
+/*
+ * Probing cycle for grid of points. All travel is done at Z of start.
+ * For each point probe moves to +Z until it is touched or depth is reached,
+ * repeated probes are made after retract. Then probe is lifted back to
+ * travel Z. After the last point probe returns to start position.
+ */
+
+static void set_move(probe_grid_plan *grid, line_plan *line, const int32_t *pos, const int32_t *target, double feed)
+{
+    int i;
+    bool probing = (grid->stage == PROBE_GRID_PROBE);
+    for (i = 0; i < 3; i++)
+        line->x[i] = target[i] - pos[i];
+    line->feed = feed;
+    line->feed0 = moves_common_def.feed_base;
+    line->feed1 = moves_common_def.feed_base;
+    line->acceleration = grid->acceleration;
+    line->stops = probing ? grid->stops : grid->stops & ~ENDSTOP_PROBE;
+    line->len = -1;
+}
+
+static bool is_empty(const line_plan *line)
+{
+    return line->x[0] == 0 && line->x[1] == 0 && line->x[2] == 0;
+}
+
+static int32_t median(int32_t *v, int n)
+{
+    int i, j, k = 0;
+    /* missed probes are skipped */
+    for (i = 0; i < n; i++)
+    {
+        if (v[i] != PROBE_GRID_MISSED)
+            v[k++] = v[i];
+    }
+    if (k == 0)
+        return PROBE_GRID_MISSED;
+    for (i = 1; i < k; i++)
+    {
+        int32_t x = v[i];
+        for (j = i; j > 0 && v[j - 1] > x; j--)
+            v[j] = v[j - 1];
+        v[j] = x;
+    }
+    return v[k / 2];
+}
+
+static bool has_room(const probe_grid_plan *grid)
+{
+    return (grid->results_head + 1) % PROBE_GRID_RESULTS != grid->results_tail;
+}
+
+// point is probed only when there is room for its result
+static void add_result(probe_grid_plan *grid, int32_t z)
+{
+    grid->results[grid->results_head] = z;
+    grid->results_head = (grid->results_head + 1) % PROBE_GRID_RESULTS;
+}
+
+static void point_target(const probe_grid_plan *grid, int point, int32_t *target)
+{
+    target[0] = grid->start[0] + grid->offset[0] + (point % grid->count[0]) * grid->pitch[0];
+    target[1] = grid->start[1] + grid->offset[1] + (point / grid->count[0]) * grid->pitch[1];
+    target[2] = grid->start[2];
+}
+
+// select next stage and its move
+static bool advance(probe_grid_plan *grid, const int32_t *pos, bool touched, line_plan *line)
+{
+    int32_t target[3] = {pos[0], pos[1], pos[2]};
+
+    switch (grid->stage)
+    {
+    case PROBE_GRID_TRAVEL:
+    case PROBE_GRID_WAIT:
+        if (!has_room(grid))
+        {
+            grid->stage = PROBE_GRID_WAIT;
+            return false;
+        }
+        grid->stage = PROBE_GRID_PROBE;
+        grid->repeat = 0;
+        grid->probe_z = pos[2];
+        target[2] = grid->probe_z + grid->depth;
+        set_move(grid, line, pos, target, grid->probe_feed);
+        return true;
+    case PROBE_GRID_PROBE:
+        grid->samples[grid->repeat++] = touched ? pos[2] - grid->start[2] : PROBE_GRID_MISSED;
+        if (touched && grid->repeat < grid->repeats)
+        {
+            grid->stage = PROBE_GRID_RETRACT;
+            target[2] = pos[2] - grid->retract;
+            if (target[2] < grid->start[2])
+                target[2] = grid->start[2];
+            set_move(grid, line, pos, target, grid->probe_feed);
+            return true;
+        }
+        add_result(grid, median(grid->samples, grid->repeat));
+        grid->stage = PROBE_GRID_LIFT;
+        target[2] = grid->start[2];
+        set_move(grid, line, pos, target, grid->travel_feed);
+        return true;
+    case PROBE_GRID_RETRACT:
+        grid->stage = PROBE_GRID_PROBE;
+        target[2] = grid->probe_z + grid->depth;
+        set_move(grid, line, pos, target, grid->probe_feed);
+        return true;
+    case PROBE_GRID_LIFT:
+        grid->point++;
+        if (grid->point >= grid->count[0] * grid->count[1])
+        {
+            grid->stage = PROBE_GRID_RETURN;
+            set_move(grid, line, pos, grid->start, grid->travel_feed);
+            return true;
+        }
+        grid->stage = PROBE_GRID_TRAVEL;
+        point_target(grid, grid->point, target);
+        set_move(grid, line, pos, target, grid->travel_feed);
+        return true;
+    case PROBE_GRID_RETURN:
+    default:
+        grid->stage = PROBE_GRID_DONE;
+        return false;
+    }
+}
+
+bool probe_grid_next(probe_grid_plan *grid, const int32_t *pos, bool touched, line_plan *line)
+{
+    do
+    {
+        if (!advance(grid, pos, touched, line))
+            return false;
+        touched = false;
+    } while (is_empty(line));
+    return true;
+}
+
+bool probe_grid_start(probe_grid_plan *grid, const int32_t *pos, line_plan *line)
+{
+    int32_t target[3];
+    int i;
+
+    for (i = 0; i < 3; i++)
+        grid->start[i] = pos[i];
+    grid->point = 0;
+    grid->repeat = 0;
+    grid->results_head = grid->results_tail = 0;
+    grid->reported = 0;
+    if (grid->count[0] == 0 || grid->count[1] == 0)
+    {
+        grid->stage = PROBE_GRID_DONE;
+        return false;
+    }
+
+    grid->stage = PROBE_GRID_TRAVEL;
+    point_target(grid, 0, target);
+    set_move(grid, line, pos, target, grid->travel_feed);
+    if (is_empty(line))
+        return probe_grid_next(grid, pos, false, line);
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <control/moves/moves_line/line.h>
+
+#define PROBE_GRID_REPEATS_MAX 5
+#define PROBE_GRID_RESULTS 8        // ring of results, which aren't reported yet
+#define PROBE_GRID_BATCH 4          // results in one report
+#define PROBE_GRID_MISSED INT32_MIN // probe isn't touched
+
+typedef enum {
+    PROBE_GRID_TRAVEL = 0,
+    PROBE_GRID_PROBE,
+    PROBE_GRID_RETRACT,
+    PROBE_GRID_LIFT,
+    PROBE_GRID_RETURN,
+    PROBE_GRID_WAIT,        // next point waits for room of results
+    PROBE_GRID_DONE,
+} probe_grid_stage;
+
+typedef struct {
+    // Specified data
+    int32_t offset[2];      // first point, relative to start. steps
+    int32_t pitch[2];       // distance between points. steps
+    uint16_t count[2];      // points along X and Y
+    int32_t depth;          // max probe move, to +Z. steps
+    int32_t retract;        // retract before repeated probe. steps
+    uint8_t repeats;        // probes of each point, median is reported
+    double probe_feed;      // mm / sec
+    double travel_feed;     // mm / sec
+    double acceleration;    // mm / sec^2
+    uint8_t stops;          // endstops, which break moves. Probe is checked only by probe moves
+
+    // Running data
+    probe_grid_stage stage;
+    int32_t start[3];       // position of start. steps
+    int32_t probe_z;        // Z of first probe of point. steps
+    uint16_t point;         // current point, row by row from first
+    uint8_t repeat;
+    int32_t samples[PROBE_GRID_REPEATS_MAX];
+
+    // Results, Z relative to start. Head is moved by moves, tail by reporting
+    int32_t results[PROBE_GRID_RESULTS];
+    volatile uint16_t results_head;
+    volatile uint16_t results_tail;
+    uint16_t reported;      // amount of reported results
+} probe_grid_plan;
+
+// start cycle from current position and prepare first move to line,
+// false if there is nothing to do
+bool probe_grid_start(probe_grid_plan *grid, const int32_t *pos, line_plan *line);
+
+// prepare next move after current one is finished, touched - probe move is broken
+// by probe. false if cycle is finished, or if it waits in PROBE_GRID_WAIT, until
+// results are reported. Waiting cycle is continued by probe_grid_next later
+bool probe_grid_next(probe_grid_plan *grid, const int32_t *pos, bool touched, line_plan *line);
+
@@ -1,15 +1,151 @@
+#include <stddef.h>
+
 #include <err/err.h>
 #include <control/tools/tools.h>
 
 static gpio_definition *def;
+
+/* tools in PWM mode */
+static float pwm_power[TOOLS_MAX];
+static volatile int pwm_duty[TOOLS_MAX];
+
+/* outputs are off while feed is held, state of tools is kept for resume */
+static volatile bool held;
+static volatile bool gpio_on[TOOLS_MAX];
+
 void tools_init(gpio_definition *definition)
 {
+    int i;
     def = definition;
+    held = false;
+    for (i = 0; i < TOOLS_MAX; i++)
+    {
+        pwm_power[i] = 0;
+        pwm_duty[i] = -1;
+        gpio_on[i] = false;
+    }
+}
+
+// tool can always be switched off
+static void set_gpio(int id, bool on)
+{
+    if (id >= 0 && id < TOOLS_MAX)
+        gpio_on[id] = on;
+    if (!held || !on)
+        def->set_gpio(id, on);
+}
+
+static void set_duty(int id, int duty)
+{
+    if (pwm_duty[id] == duty)
+        return;
+    pwm_duty[id] = duty;
+    if (!held)
+        def->set_pwm(id, duty);
+}
+
+// Hold is set from step tick of moves, or while moves are stopped, so tools aren't switched meanwhile
+void tools_set_hold(bool hold)
+{
+    int i;
+    if (hold == held)
+        return;
+    held = hold;
+    for (i = 0; i < TOOLS_MAX; i++)
+    {
+        if (gpio_on[i])
+            def->set_gpio(i, !hold);
+        if (def->set_pwm != NULL && pwm_duty[i] > 0)
+            def->set_pwm(i, hold ? 0 : pwm_duty[i]);
+    }
+}
+
+void tools_cancel_hold(void)
+{
+    int i;
+    if (!held)
+        return;
+    for (i = 0; i < TOOLS_MAX; i++)
+    {
+        gpio_on[i] = false;
+        pwm_power[i] = 0;
+        if (pwm_duty[i] > 0)
+            pwm_duty[i] = 0;
+    }
+    held = false;
+}
+
+static int raster_level = -1;
+
+void tool_raster_start(void)
+{
+    raster_level = -1;
+}
+
+void tool_raster_pixel(const tool_raster *raster, int pixel)
+{
+    int level = 0;
+    int max = (1 << raster->bits) - 1;
+    if (pixel < raster->pixels)
+    {
+        int bit = pixel * raster->bits;
+        level = (raster->data[bit / 8] >> (8 - raster->bits - bit % 8)) & max;
+    }
+    if (level == raster_level)
+        return;
+
+    if (raster_level <= 0 || level == 0)
+        set_gpio(raster->id, level > 0);
+    raster_level = level;
+    if (def->set_pwm != NULL && raster->id < TOOLS_MAX)
+        set_duty(raster->id, level * TOOL_PWM_MAX / max);
+}
+
+void tools_feed_update(double ratio)
+{
+    int i;
+    if (def->set_pwm == NULL)
+        return;
+    if (ratio > 1)
+        ratio = 1;
+    else if (ratio < 0)
+        ratio = 0;
+    for (i = 0; i < TOOLS_MAX; i++)
+    {
+        if (pwm_power[i] > 0)
+            set_duty(i, pwm_power[i] * ratio * TOOL_PWM_MAX + 0.5);
+    }
+}
+
+void tool_set(int id, bool on)
+{
+	set_gpio(id, on);
 }
 
 int tool_action(tool_plan *plan)
 {
-	def->set_gpio(plan->id, plan->on);
+	int id = plan->id;
+	if (def->set_pwm != NULL && id >= 0 && id < TOOLS_MAX)
+	{
+		if (plan->on && plan->power > 0)
+		{
+			pwm_power[id] = plan->power > 1 ? 1 : plan->power;
+			set_duty(id, 0);
+		}
+		else if (pwm_power[id] > 0)
+		{
+			pwm_power[id] = 0;
+			set_duty(id, 0);
+		}
+	}
+	tool_set(id, plan->on);
+	return -E_NEXT;
+}
+
+int modbus_action(modbus_plan *plan)
+{
+	if (def->modbus_write)
+		def->modbus_write(plan->device, plan->reg, plan->value);
 	return -E_NEXT;
 }
 
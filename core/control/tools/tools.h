@@ -1,18 +1,68 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct
 {
 	void (*set_gpio)(int id, int state);
+	void (*modbus_write)(int device, int reg, int value); // must not block, may be NULL
+	void (*set_pwm)(int id, int duty);    // duty 0..TOOL_PWM_MAX, may be NULL
 } gpio_definition;
 
+#define TOOLS_MAX 4
+#define TOOL_PWM_MAX 255
+#define TOOL_PWM_PERIOD 0.005   // minimal period of duty updates. sec
+
 typedef struct
 {
     bool on;
     int id;
+    float power;    // > 0 - PWM mode, duty at target feed 0..1, proportional to current feed
 } tool_plan;
 
+// tool switch inside of line or arc, before specified tick of move
+typedef struct
+{
+    uint32_t step;
+    uint8_t id;
+    bool on;
+} tool_event;
+
+#define TOOL_EVENTS_MAX 4
+
+// power levels of tool along line, one pixel per pitch steps of line
+typedef struct
+{
+    const uint8_t *data;    // packed levels, first pixel in high bits of byte
+    uint16_t pixels;
+    uint16_t pitch;         // steps of line per pixel
+    uint8_t bits;           // bits per pixel: 1, 2, 4 or 8
+    uint8_t id;             // tool
+} tool_raster;
+
+typedef struct
+{
+    uint8_t device;
+    uint16_t reg;
+    uint16_t value;
+} modbus_plan;
+
 void tools_init(gpio_definition *definition);
 int tool_action(tool_plan *plan);
+void tool_set(int id, bool on);
+
+// set tool to power level of pixel, pixels after the last are 0
+void tool_raster_start(void);
+void tool_raster_pixel(const tool_raster *raster, int pixel);
+
+// update duty of PWM tools, ratio - current feed / target feed
+void tools_feed_update(double ratio);
+
+// feed hold: tools are off, but keep their state, and are switched on again on release
+void tools_set_hold(bool hold);
+
+// hold is dropped by abort, held tools stay off
+void tools_cancel_hold(void);
+int modbus_action(modbus_plan *plan);
 
@@ -2,3 +2,8 @@
 
 #include "arch-defs.h"
 
+/* compare and swap of byte, which is shared with interrupts. Arch can define own one */
+#ifndef ATOMIC_CAS_U8
+#define ATOMIC_CAS_U8(ptr, expected, desired) \
+    __atomic_compare_exchange_n((ptr), (expected), (desired), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#endif
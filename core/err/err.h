@@ -12,4 +12,5 @@ enum {
     E_ENDSTOP = 8,
     E_NEXT = 9,
     E_WAIT = 10,
+    E_LIMITS = 11,
 };
@@ -118,6 +118,29 @@ static int read_double(const unsigned char **str, const unsigned char *end, doub
     return -E_BADNUM;
 }
 
+static int read_bytes(const unsigned char **str, const unsigned char *end, gcode_cmd_t *cmd)
+{
+    const unsigned char *start = *str;
+    while (*str < end && is_hex(**str))
+        (*str)++;
+    if ((*str - start) % 2 != 0)
+        return -E_BADNUM;
+    cmd->val_b.ptr = start;
+    cmd->val_b.len = *str - start;
+    return E_OK;
+}
+
+int gcode_decode_hex(const gcode_cmd_t *cmd, uint8_t *buf, size_t maxlen)
+{
+    size_t i;
+    size_t len = cmd->val_b.len / 2;
+    if (len > maxlen)
+        return -E_NOMEM;
+    for (i = 0; i < len; i++)
+        buf[i] = hex_decode(cmd->val_b.ptr[2*i]) << 4 | hex_decode(cmd->val_b.ptr[2*i+1]);
+    return len;
+}
+
 static bool is_float(const unsigned char *str, const unsigned char *end)
 {
     while (str < end)
@@ -152,7 +175,13 @@ static int parse_element(const unsigned char **str, const unsigned char *end, gc
   
     cmd->type = **str;
     (*str)++;
-    if (is_float(*str, end))
+    if (*str < end && **str == '#')
+    {
+        (*str)++;
+        if (read_bytes(str, end, cmd))
+            return -E_BADNUM;
+    }
+    else if (is_float(*str, end))
     {
         if (read_double(str, end, &(cmd->val_f)))
             return -E_BADNUM;
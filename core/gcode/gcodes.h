@@ -11,6 +11,10 @@ typedef struct {
     union {
         int32_t val_i;
         double val_f;
+        struct {
+            const unsigned char *ptr;   // hex digits
+            uint16_t len;
+        } val_b;
     };
 } gcode_cmd_t;
 
@@ -20,3 +24,6 @@ typedef struct {
 } gcode_frame_t;
 
 int parse_cmdline(const unsigned char *str, size_t len, gcode_frame_t *frame);
+
+// decode hex value of element, written as X#0a1b2c
+int gcode_decode_hex(const gcode_cmd_t *cmd, uint8_t *buf, size_t maxlen);
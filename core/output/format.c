@@ -0,0 +1,70 @@
+#include <output/format.h>
+
+char *fmt_str(char *p, char *end, const char *s)
+{
+    while (*s && p < end)
+        *p++ = *s++;
+    return p;
+}
+
+char *fmt_mem(char *p, char *end, const char *s, size_t len)
+{
+    while (len > 0 && p < end)
+    {
+        *p++ = *s++;
+        len--;
+    }
+    return p;
+}
+
+char *fmt_int(char *p, char *end, int32_t v)
+{
+    char tmp[10];
+    int n = 0;
+    uint32_t u = v;
+
+    if (v < 0)
+    {
+        u = -u;
+        if (p < end)
+            *p++ = '-';
+    }
+
+    do
+    {
+        tmp[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+
+    while (n > 0 && p < end)
+        *p++ = tmp[--n];
+    return p;
+}
+
+size_t fmt_int_len(int32_t v)
+{
+    size_t n = 1;
+    uint32_t u = v;
+
+    if (v < 0)
+    {
+        u = -u;
+        n++;
+    }
+    while (u >= 10)
+    {
+        u /= 10;
+        n++;
+    }
+    return n;
+}
+
+char *fmt_hex(char *p, char *end, uint8_t v)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    if (p < end)
+        *p++ = digits[v >> 4];
+    if (p < end)
+        *p++ = digits[v & 0x0F];
+    return p;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal formatting of messages into caller buffer, without varargs.
+ * Each function writes to p, not further than end, and returns
+ * pointer after written text. Result is not 0-terminated.
+ */
+
+// length of string literal, for reserving place of text written by fmt_str
+#define FMT_STR_LEN(s) (sizeof(s) - 1)
+
+// append string
+char *fmt_str(char *p, char *end, const char *s);
+
+// append len bytes of s
+char *fmt_mem(char *p, char *end, const char *s, size_t len);
+
+// append decimal integer
+char *fmt_int(char *p, char *end, int32_t v);
+
+// length of decimal integer
+size_t fmt_int_len(int32_t v);
+
+// append byte as 2 uppercase hex digits
+char *fmt_hex(char *p, char *end, uint8_t v);
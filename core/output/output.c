@@ -5,6 +5,13 @@
 static int control_fd;
 static int shell_fd;
 static ssize_t (*write_fun)(int, const void *, ssize_t);
+static char *(*control_reserve_fun)(size_t);
+static void (*control_commit_fun)(size_t);
+
+#define OUTPUT_BUF_LEN 128
+
+// used when output has no in-place writing
+static char output_buf[OUTPUT_BUF_LEN];
 
 void output_control_set_fd(int fd)
 {
@@ -21,6 +28,29 @@ void output_set_write_fun(ssize_t (*write_f)(int, const void *, ssize_t))
     write_fun = write_f;
 }
 
+void output_set_control_reserve_fun(char *(*reserve_f)(size_t), void (*commit_f)(size_t))
+{
+    control_reserve_fun = reserve_f;
+    control_commit_fun = commit_f;
+}
+
+char *output_control_reserve(size_t len)
+{
+    if (control_reserve_fun)
+        return control_reserve_fun(len);
+    if (len > OUTPUT_BUF_LEN)
+        return NULL;
+    return output_buf;
+}
+
+void output_control_commit(size_t len)
+{
+    if (control_commit_fun)
+        control_commit_fun(len);
+    else
+        write_fun(control_fd, output_buf, len);
+}
+
 void output_control_write(const char *buf, ssize_t len)
 {
     if (len < 0)
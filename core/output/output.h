@@ -7,5 +7,13 @@ void output_shell_set_fd(int fd);
 
 void output_set_write_fun(ssize_t (*write_f)(int, const void *, ssize_t));
 
+// Set functions for writing control messages in place of output buffer
+void output_set_control_reserve_fun(char *(*reserve_f)(size_t), void (*commit_f)(size_t));
+
 void output_control_write(const char *buf, ssize_t len);
 void output_shell_write(const char *buf, ssize_t len);
+
+// Get place for control message of at most len bytes, NULL if there is no place
+char *output_control_reserve(size_t len);
+// Send reserved message of actual len
+void output_control_commit(size_t len);
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * Span instrumentation of command path. Platform implements trace_begin,
+ * trace_end and trace_dump when CONFIG_TRACE is enabled, otherwise
+ * macros are empty. Name must be a string constant.
+ */
+
+#ifdef CONFIG_TRACE
+
+void trace_begin(const char *name);
+void trace_end(const char *name);
+void trace_dump(void);
+
+static inline void trace_scope_end(const char **name)
+{
+    trace_end(*name);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_BEGIN(name) trace_begin(name)
+#define TRACE_END(name) trace_end(name)
+#define TRACE_SCOPE(name) \
+    const char *TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(trace_scope_end))) = (name); \
+    trace_begin(name)
+#define TRACE_DUMP() trace_dump()
+
+#else
+
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_DUMP() do {} while (0)
+
+#endif
@@ -1,6 +1,8 @@
 #include <line.h>
 #include <err.h>
 #include <assert.h>
+#include <math.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <planner.h>
 
@@ -9,16 +11,14 @@
 #define FEED_BASE 5
 #define FEED_MAX 1500
 
-#define SIZE_X 1000
-#define SIZE_Y 1000
-#define SIZE_Z 1000
-
 static volatile int moving = 0;
+static int lines_started, lines_finished;
 
 static void line_started(void)
 {
     printf("Line started\n");
     moving = 1;
+    lines_started++;
 }
 
 
@@ -26,6 +26,7 @@ static void line_finished(void)
 {
     printf("Line finished\n");
     moving = 0;
+    lines_finished++;
 }
 
 static void line_error(void)
@@ -39,9 +40,9 @@ static int s[3], d[3] = {1, 1, 1};
 static cnc_endstops get_stops(void)
 {
     cnc_endstops stops = {
-        .stop_x = s[0] <= 0,
-        .stop_y = s[1] <= 0,
-        .stop_z = s[2] <= 0,
+        .stop_x = s[0] < 0,
+        .stop_y = s[1] < 0,
+        .stop_z = s[2] < 0,
         .probe = 0,
     };
 
@@ -66,14 +67,23 @@ static void send_queued(int nid)
     printf("%i queued\n", nid);
 }
 
+static int started, completed;
+static int last_started = -1, last_completed = -1;
+
 static void send_started(int nid)
 {
     printf("%i started\n", nid);
+    assert(nid > last_started);
+    last_started = nid;
+    started++;
 }
 
 static void send_completed(int nid)
 {
     printf("%i completed\n", nid);
+    assert(nid > last_completed);
+    last_completed = nid;
+    completed++;
 }
 
 static void send_completed_with_pos(int nid, const int *pos)
@@ -86,9 +96,28 @@ static void send_dropped(int nid)
     printf("%i dropped\n", nid);
 }
 
+static int failed;
+
 static void send_failed(int nid)
 {
     printf("%i failed\n", nid);
+    failed++;
+}
+
+static int probed;
+
+static void send_probed(int nid, int index, const int32_t *values, int n)
+{
+    printf("%i probed %i points from %i\n", nid, n, index);
+    assert(index == probed);
+    probed += n;
+}
+
+static int gpio[4];
+
+static void set_gpio(int id, int on)
+{
+    gpio[id] = on;
 }
 
 static void init(void)
@@ -107,18 +136,19 @@ static void init(void)
         },
         .feed_base = FEED_BASE,
         .feed_max = FEED_MAX,
-        .size = {
-            SIZE_X,
-            SIZE_Y,
-            SIZE_Z,
-        },
         .acc_default = ACC,
+        .configured = true,
     };
 
     static gpio_definition gd = {
+        .set_gpio = set_gpio,
     };
 
-    init_planner(&sd, &gd, send_queued, send_started, send_completed, send_completed_with_pos, send_dropped, send_failed);
+    started = completed = failed = probed = 0;
+    last_started = last_completed = -1;
+    lines_started = lines_finished = 0;
+
+    init_planner(&sd, &gd, send_queued, send_started, send_completed, send_completed_with_pos, send_dropped, send_failed, send_probed);
 }
 
 void test_line(void)
@@ -166,15 +196,428 @@ void test_multiple_lines(void)
     while(moving)
     {
         moves_step_tick();
+        planner_pre_calculate();
     }
 
     for (i = 0; i < 3; i++)
         assert(s[i] == x1[i] + x2[i] + x3[i]);
 }
 
+void test_events_fifo(void)
+{
+    int n = 0;
+    printf("\ntest_events_fifo\n");
+
+    init();
+    planner_unlock();
+
+    /* tool records complete at once, their events wait for reporting */
+    while (planner_tool(0, n % 2, 0, n) >= 0)
+        n++;
+    assert(empty_slots() == 0);
+
+    /* tool records are small, so queue is limited by FIFO of 32 events */
+    assert(n == 15);
+
+    planner_report_states();
+    assert(started == n);
+    assert(completed == n);
+    assert(last_completed == n - 1);
+
+    /* queue is free again */
+    assert(planner_tool(0, false, 0, n) >= 0);
+    planner_report_states();
+    assert(completed == n + 1);
+}
+
+void test_soft_limits(void)
+{
+    int i;
+    int32_t lo[3], hi[3];
+    printf("\ntest_soft_limits\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_unlock();
+
+    /* envelope is narrow along X on the positive side */
+    for (i = 0; i < 3; i++)
+    {
+        lo[i] = -4000;
+        hi[i] = 4000;
+    }
+    hi[0] = 500;
+    planner_set_soft_limits(true, lo, hi);
+
+    int32_t far[3] = {1000, 0, 0};
+    assert(planner_line_to(far, 15, 0, 0, 40, 1) == -E_LIMITS);
+
+    /* homed axes don't stop on endstops, position 0 is the first step on endstop */
+    int32_t dist[3] = {100, 100, 100};
+    assert(planner_homing(dist, 20, 15, 5, 40, 3) >= 0);
+    while (moving)
+    {
+        moves_step_tick();
+    }
+    for (i = 0; i < 3; i++)
+        assert(s[i] == -1);
+
+    /* ends of arc are at the same X, but it passes through extremum at X + 586 */
+    int32_t x1[2] = {1414, -1414};
+    int32_t x2[2] = {1414, 1414};
+    double len = 2000 * M_PI / 2 / STEPS_PER_MM;
+    assert(planner_arc_to(x1, x2, 0, len, 2000, 2000, XY, 0, 15, 0, 0, 40, 2) == -E_LIMITS);
+
+    /* clockwise one goes around through negative X */
+    assert(planner_arc_to(x1, x2, 0, 3 * len, 2000, 2000, XY, 1, 15, 0, 0, 40, 4) >= 0);
+    assert(moving == 1);
+    while (moving)
+    {
+        moves_step_tick();
+    }
+    assert(!planner_is_locked());
+    assert(abs(s[0] + 1) <= 1 && abs(s[1] + 1 - 2828) <= 1 && s[2] == -1);
+
+    planner_set_soft_limits(false, NULL, NULL);
+}
+
+void test_soft_limits_unhomed(void)
+{
+    int i;
+    int32_t lo[3], hi[3];
+    printf("\ntest_soft_limits_unhomed\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_unlock();
+
+    for (i = 0; i < 3; i++)
+    {
+        lo[i] = -4000;
+        hi[i] = 4000;
+    }
+    planner_set_soft_limits(true, lo, hi);
+
+    /* position isn't known before homing, so endstops still break moves */
+    int32_t x[3] = {-1000, 0, 0};
+    assert(planner_line_to(x, 15, 0, 0, 40, 1) >= 0);
+    while (moving)
+    {
+        moves_step_tick();
+    }
+    planner_report_states();
+    assert(failed == 1 && planner_is_locked());
+    assert(s[0] == -1);
+
+    planner_set_soft_limits(false, NULL, NULL);
+}
+
+void test_merge(void)
+{
+    printf("\ntest_merge\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_set_merge(5, 0.01);
+    planner_unlock();
+
+    /* first line starts at once, next ones are merged into one record */
+    int32_t x[3] = {1000, 0, 0};
+    int32_t y[3] = {1000, 200, 0};
+    planner_line_to(x, 15, 0, 0, 40, 1);
+    planner_line_to(x, 15, 0, 0, 40, 2);
+    planner_line_to(x, 15, 0, 0, 40, 3);
+    planner_line_to(x, 15, 0, 0, 40, 4);
+
+    /* turn is more than merge angle */
+    planner_line_to(y, 15, 0, 0, 40, 5);
+
+    while (moving)
+    {
+        moves_step_tick();
+        planner_report_states();
+        planner_pre_calculate();
+    }
+    planner_report_states();
+
+    assert(lines_started == 3);
+    assert(s[0] == 5000 && s[1] == 200 && s[2] == 0);
+    assert(started == 5 && completed == 5);
+}
+
+void test_merge_failed(void)
+{
+    printf("\ntest_merge_failed\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_set_merge(5, 0.01);
+    planner_unlock();
+
+    /* merged lines run into endstop at X < 0 */
+    int32_t x[3] = {1000, 0, 0};
+    int32_t back[3] = {-1000, 0, 0};
+    planner_line_to(x, 15, 0, 0, 40, 1);
+    planner_line_to(back, 15, 0, 0, 40, 2);
+    planner_line_to(back, 15, 0, 0, 40, 3);
+    planner_line_to(back, 15, 0, 0, 40, 4);
+
+    while (moving)
+    {
+        moves_step_tick();
+        planner_report_states();
+        planner_pre_calculate();
+    }
+    planner_report_states();
+
+    /* each nid of merged record is reported */
+    assert(lines_started == 2);
+    assert(completed == 1 && failed == 3);
+    assert(planner_is_locked());
+}
+
+// feed of single axis move by delay of its tick. mm / sec
+static double tick_feed(int32_t delay)
+{
+    return 1000000.0 / STEPS_PER_MM / delay;
+}
+
+void test_end_deceleration(void)
+{
+    double exit_feed[3] = {0, 0, 0};
+    double max_feed = 0;
+    printf("\ntest_end_deceleration\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_set_merge(0, 0);
+    planner_unlock();
+
+    /* exit feeds are requested, but queue ends after each line */
+    int32_t x[3] = {4000, 0, 0};
+    planner_line_to(x, 15, 15, 15, 40, 1);
+    planner_line_to(x, 15, 15, 15, 40, 2);
+    planner_line_to(x, 15, 15, 15, 40, 3);
+    while (moving)
+    {
+        int32_t delay = moves_step_tick();
+        planner_pre_calculate();
+        if (delay > 0 && lines_finished < 3)
+        {
+            exit_feed[lines_finished] = tick_feed(delay);
+            if (exit_feed[lines_finished] > max_feed)
+                max_feed = exit_feed[lines_finished];
+        }
+    }
+    printf("exit feeds %lf %lf %lf, max %lf\n", exit_feed[0], exit_feed[1], exit_feed[2], max_feed);
+
+    /* first line was the last one when it started, its exit isn't raised later */
+    assert(exit_feed[0] < FEED_BASE * 1.1);
+    /* junction of queued lines isn't stopped */
+    assert(exit_feed[1] > FEED_BASE * 2);
+    /* end of queue is */
+    assert(exit_feed[2] < FEED_BASE * 1.1);
+    assert(max_feed < 15 * 1.05);
+    assert(s[0] == 3 * x[0] && s[1] == 0 && s[2] == 0);
+}
+
+void test_private_tail(void)
+{
+    double feed = 0;
+    printf("\ntest_private_tail\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_set_merge(0, 0);
+    planner_unlock();
+
+    /* the second line waits for merging at the tail, moves can't start it */
+    int32_t x[3] = {4000, 0, 0};
+    planner_line_to(x, 15, 15, 15, 40, 1);
+    planner_line_to(x, 15, 15, 15, 40, 2);
+    while (moving)
+    {
+        int32_t delay = moves_step_tick();
+        if (delay > 0)
+            feed = tick_feed(delay);
+    }
+
+    /* so the first one stops as the last published one */
+    printf("exit feed %lf\n", feed);
+    assert(feed < FEED_BASE * 1.1);
+    assert(s[0] == x[0] && lines_started == 1);
+
+    /* and background publishes and starts the tail */
+    planner_pre_calculate();
+    assert(moving == 1);
+    while (moving)
+        moves_step_tick();
+    assert(s[0] == 2 * x[0] && lines_started == 2);
+}
+
+void test_override(void)
+{
+    int steps = 0;
+    double feed = 0, max_feed = 0;
+    printf("\ntest_override\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_unlock();
+
+    int32_t x[3] = {16000, 0, 0};
+    planner_line_to(x, 15, 0, 0, 40, 1);
+
+    /* cruise with target feed */
+    while (feed < 15 * 0.99)
+        feed = tick_feed(moves_step_tick());
+
+    /* running move ramps down to overridden feed and cruises there */
+    moves_set_feed_override(0.5);
+    for (steps = 0; steps < 4000; steps++)
+        feed = tick_feed(moves_step_tick());
+    printf("overridden feed %lf\n", feed);
+    assert(fabs(feed - 7.5) < 0.2);
+
+    /* and ramps back, still stopping at the end */
+    moves_set_feed_override(1);
+    while (moving)
+    {
+        int32_t delay = moves_step_tick();
+        if (delay > 0)
+        {
+            feed = tick_feed(delay);
+            if (feed > max_feed)
+                max_feed = feed;
+        }
+    }
+    printf("restored feed %lf, exit feed %lf\n", max_feed, feed);
+    assert(fabs(max_feed - 15) < 0.2);
+    assert(feed < FEED_BASE * 1.1);
+    assert(s[0] == x[0]);
+}
+
+void test_hold(void)
+{
+    int i;
+    double feed = 0;
+    int32_t pos;
+    printf("\ntest_hold\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_unlock();
+
+    int32_t x[3] = {16000, 0, 0};
+    planner_tool(0, true, 0, 1);
+    planner_line_to(x, 15, 0, 0, 40, 2);
+    planner_report_states();
+    assert(gpio[0] == 1);
+
+    while (feed < 15 * 0.99)
+        feed = tick_feed(moves_step_tick());
+
+    /* tool is off on the next tick, move slows down to base feed and waits */
+    moves_set_hold(true);
+    assert(gpio[0] == 1);
+    moves_step_tick();
+    assert(gpio[0] == 0);
+    for (;;)
+    {
+        int32_t delay = moves_step_tick();
+        pos = s[0];
+        if (tick_feed(delay) <= FEED_BASE)
+            break;
+    }
+    for (i = 0; i < 100; i++)
+        moves_step_tick();
+    assert(s[0] == pos && s[0] < x[0]);
+    assert(moving == 1 && moves_is_held());
+
+    /* queue is kept while held */
+    planner_tool(1, true, 0, 3);
+    assert(gpio[1] == 0);
+
+    moves_set_hold(false);
+    moves_step_tick();
+    assert(gpio[0] == 1);
+    while (moving)
+    {
+        moves_step_tick();
+        planner_pre_calculate();
+    }
+    planner_report_states();
+    assert(s[0] == x[0]);
+    assert(gpio[1] == 1);
+    assert(completed == 3);
+
+    planner_tool(0, false, 0, 4);
+    planner_tool(1, false, 0, 5);
+    assert(gpio[0] == 0 && gpio[1] == 0);
+
+    /* stopped moves pass hold to tools at once */
+    planner_tool(0, true, 0, 6);
+    moves_set_hold(true);
+    assert(gpio[0] == 0);
+    moves_set_hold(false);
+    assert(gpio[0] == 1);
+    planner_tool(0, false, 0, 7);
+}
+
+void test_probe_grid_wait(void)
+{
+    int32_t offset[2] = {0, 0};
+    int32_t pitch[2] = {40, 40};
+    int count[2] = {5, 2};
+    printf("\ntest_probe_grid_wait\n");
+
+    s[0] = s[1] = s[2] = 0;
+
+    init();
+    planner_unlock();
+
+    planner_probe_grid(offset, pitch, count, 40, 0, 1, 5, 5, ACC, 1);
+    assert(moving == 1);
+    while (moving)
+        moves_step_tick();
+
+    /* results aren't reported, so cycle stops at 8th point, when their ring is full */
+    assert(probed == 0 && completed == 0);
+    assert(s[0] == 2 * pitch[0] && s[1] == pitch[1]);
+
+    /* reporting frees the ring and continues the cycle */
+    while (completed == 0)
+    {
+        planner_report_states();
+        while (moving)
+            moves_step_tick();
+    }
+    assert(probed == count[0] * count[1]);
+    assert(s[0] == 0 && s[1] == 0 && s[2] == 0);
+}
+
 int main(void)
 {
+    test_line();
     test_multiple_lines();
+    test_events_fifo();
+    test_soft_limits();
+    test_soft_limits_unhomed();
+    test_merge();
+    test_merge_failed();
+    test_end_deceleration();
+    test_private_tail();
+    test_override();
+    test_hold();
+    test_probe_grid_wait();
 
     return 0;
 }
@@ -0,0 +1,470 @@
+#include "modbus.h"
+#include "master.h"
+
+#include <output/format.h>
+
+typedef struct {
+    uint8_t device;
+    uint8_t function;
+    uint16_t reg;
+    uint8_t count;
+    uint16_t vals[MODBUS_MASTER_MAX_REGS];
+} modbus_request;
+
+typedef enum {
+    MASTER_IDLE = 0,
+    MASTER_TX,
+    MASTER_WAIT,
+    MASTER_RX,
+} master_state;
+
+#define MODBUS_FRAME_LEN 256
+
+uint32_t modbus_master_errors = 0;
+
+static modbus_request queue[MODBUS_MASTER_QUEUE_LEN];
+static volatile uint8_t qfirst = 0;
+static volatile uint8_t qlast = 0;
+static volatile uint8_t qlen = 0;
+static volatile bool queue_busy = false;    // queue is modified from main context
+
+/* writes from planner, they are added from interrupt and aren't joined */
+static modbus_request motion_queue[MODBUS_MASTER_MOTION_QUEUE_LEN];
+static volatile uint8_t mfirst = 0;
+static volatile uint8_t mlast = 0;
+static volatile bool motion_cur = false;   // current request is from motion queue
+
+static volatile master_state state = MASTER_IDLE;
+static volatile uint16_t idle_chars = MODBUS_FRAME_GAP_CHARS;
+
+static modbus_poll_entry polls[MODBUS_MASTER_POLL_LEN];
+static volatile uint8_t poll_len = 0;
+static uint8_t poll_next = 0;
+static int8_t poll_cur = -1;        // entry being read, -1 if request is from queue
+static uint32_t now = 0;            // characters
+static uint32_t last_poll = 0;
+static uint16_t char_time_us;
+
+static uint8_t txbuf[MODBUS_FRAME_LEN];
+static uint16_t txlen, txpos;
+static uint8_t rxbuf[MODBUS_FRAME_LEN];
+static uint16_t rxlen;
+
+static void (*port_start_tx)(void);
+
+void modbus_master_init(void (*start_tx)(void), uint16_t char_us)
+{
+    port_start_tx = start_tx;
+    char_time_us = char_us;
+    qfirst = qlast = qlen = 0;
+    mfirst = mlast = 0;
+    motion_cur = false;
+    poll_len = 0;
+    poll_cur = -1;
+    state = MASTER_IDLE;
+    idle_chars = MODBUS_FRAME_GAP_CHARS;
+}
+
+int modbus_master_empty_slots(void)
+{
+    return MODBUS_MASTER_QUEUE_LEN - qlen;
+}
+
+static bool can_join(const modbus_request *req, uint8_t device, uint16_t reg)
+{
+    if (req->device != device)
+        return false;
+    if (req->function != FUNCTION_WRITE_AO && req->function != FUNCTION_WRITE_MULTIPLE_AO)
+        return false;
+    if (req->count >= MODBUS_MASTER_MAX_REGS)
+        return false;
+    return req->reg + req->count == reg;
+}
+
+bool modbus_master_write(uint8_t device, uint16_t reg, uint16_t val)
+{
+    bool res = false;
+    queue_busy = true;
+
+    /* join with last request, if it isn't being sent */
+    if (qlen > 0)
+    {
+        uint8_t last = (qlast + MODBUS_MASTER_QUEUE_LEN - 1) % MODBUS_MASTER_QUEUE_LEN;
+        modbus_request *req = &queue[last];
+        bool sending = (last == qfirst && state != MASTER_IDLE && poll_cur < 0 && !motion_cur);
+        if (!sending && can_join(req, device, reg))
+        {
+            req->vals[req->count++] = val;
+            req->function = FUNCTION_WRITE_MULTIPLE_AO;
+            res = true;
+            goto out;
+        }
+    }
+
+    if (qlen < MODBUS_MASTER_QUEUE_LEN)
+    {
+        modbus_request *req = &queue[qlast];
+        req->device = device;
+        req->function = FUNCTION_WRITE_AO;
+        req->reg = reg;
+        req->count = 1;
+        req->vals[0] = val;
+        qlast = (qlast + 1) % MODBUS_MASTER_QUEUE_LEN;
+        qlen++;
+        res = true;
+    }
+    else
+    {
+        modbus_master_errors++;
+    }
+
+out:
+    queue_busy = false;
+    return res;
+}
+
+int modbus_master_poll_add(uint8_t device, uint8_t function, uint16_t reg)
+{
+    int i;
+    if (function != FUNCTION_READ_AO && function != FUNCTION_READ_AI)
+        return -1;
+    for (i = 0; i < poll_len; i++)
+    {
+        if (polls[i].device == device && polls[i].function == function && polls[i].reg == reg)
+            return i;
+    }
+    if (poll_len == MODBUS_MASTER_POLL_LEN)
+        return -1;
+
+    modbus_poll_entry *entry = &polls[poll_len];
+    entry->device = device;
+    entry->function = function;
+    entry->reg = reg;
+    entry->valid = false;
+    return poll_len++;
+}
+
+int modbus_master_poll_count(void)
+{
+    return poll_len;
+}
+
+bool modbus_master_poll_get(int i, modbus_poll_entry *entry, int32_t *age_ms)
+{
+    if (i < 0 || i >= poll_len)
+        return false;
+    *entry = polls[i];
+    if (entry->valid)
+        *age_ms = (uint64_t)(now - entry->time) * char_time_us / 1000;
+    else
+        *age_ms = -1;
+    return true;
+}
+
+bool modbus_master_write_motion(uint8_t device, uint16_t reg, uint16_t val)
+{
+    uint8_t next = (mlast + 1) % MODBUS_MASTER_MOTION_QUEUE_LEN;
+    if (next == mfirst)
+    {
+        modbus_master_errors++;
+        return false;
+    }
+    modbus_request *req = &motion_queue[mlast];
+    req->device = device;
+    req->function = FUNCTION_WRITE_AO;
+    req->reg = reg;
+    req->count = 1;
+    req->vals[0] = val;
+    /* request is written before it is queued */
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    mlast = next;
+    return true;
+}
+
+bool modbus_master_write_cmd(const char *cmd, size_t len)
+{
+    if (len < 4+1+4+1+4)
+        return false;
+    int devid = modbus_read_hex16(cmd);
+    int addr = modbus_read_hex16(cmd + 4+1);
+    int val = modbus_read_hex16(cmd + 4+1+4+1);
+    if (devid < 0 || devid > 0xFF || addr < 0 || val < 0)
+        return false;
+    return modbus_master_write(devid, addr, val);
+}
+
+static char *put_hex16(char *p, char *end, uint16_t v)
+{
+    p = fmt_hex(p, end, v >> 8);
+    return fmt_hex(p, end, v & 0xFF);
+}
+
+static void reply_polls(void (*reply)(const char *msg, ssize_t len))
+{
+    int i;
+    for (i = 0; i < poll_len; i++)
+    {
+        char buf[40];
+        char *p = buf;
+        char *end = buf + sizeof(buf);
+        modbus_poll_entry entry;
+        int32_t age;
+        modbus_master_poll_get(i, &entry, &age);
+        p = fmt_str(p, end, "MBR:");
+        p = put_hex16(p, end, entry.device);
+        p = fmt_str(p, end, ":");
+        p = put_hex16(p, end, entry.reg);
+        p = fmt_str(p, end, "=");
+        if (entry.valid)
+        {
+            p = put_hex16(p, end, entry.value);
+            p = fmt_str(p, end, " T:");
+            p = fmt_int(p, end, age);
+        }
+        else
+        {
+            p = fmt_str(p, end, "----");
+        }
+        reply(buf, p - buf);
+    }
+}
+
+bool modbus_master_command(const char *line, size_t len,
+                           void (*reply)(const char *msg, ssize_t len))
+{
+    bool ok;
+    if (len >= 4 && !memcmp(line, "MBR:", 4))
+    {
+        reply_polls(reply);
+        return true;
+    }
+    else if (len >= 4 && !memcmp(line, "MBP:", 4))
+    {
+        ok = false;
+        if (len >= 4 + 4+1+4+1+4)
+        {
+            int devid = modbus_read_hex16(line + 4);
+            int addr = modbus_read_hex16(line + 4 + 4+1);
+            int fn = modbus_read_hex16(line + 4 + 4+1+4+1);
+            ok = devid >= 0 && devid <= 0xFF && addr >= 0 && fn >= 0 &&
+                 modbus_master_poll_add(devid, fn, addr) >= 0;
+        }
+    }
+    else if (len >= 3 && !memcmp(line, "MB:", 3))
+    {
+        ok = modbus_master_write_cmd(line + 3, len - 3);
+    }
+    else
+    {
+        return false;
+    }
+
+    if (!ok)
+        reply("MB: error", -1);
+    return true;
+}
+
+static void build_frame(uint8_t device, uint8_t function, uint16_t reg, uint8_t count, const uint16_t *vals)
+{
+    ssize_t len;
+    uint8_t *data = txbuf + MODBUS_HEADER_LEN;
+    switch (function)
+    {
+    case FUNCTION_WRITE_AO:
+        len = modbus_fill_write_ao(data, reg, vals[0]);
+        break;
+    case FUNCTION_WRITE_MULTIPLE_AO:
+        len = modbus_fill_write_multiple_ao(data, reg, count, vals);
+        break;
+    default:
+        len = modbus_fill_read(data, reg, count);
+        break;
+    }
+    txlen = modbus_fill_header(txbuf, device, function, len);
+    txpos = 0;
+}
+
+static const modbus_request *current_request(void)
+{
+    if (motion_cur)
+        return &motion_queue[mfirst];
+    return &queue[qfirst];
+}
+
+/* command queue has write to register of motion request, it was queued earlier,
+ * so it is sent first */
+static bool queued_before(const modbus_request *mreq)
+{
+    uint8_t i, n = qlen;
+    for (i = 0; i < n; i++)
+    {
+        const modbus_request *req = &queue[(qfirst + i) % MODBUS_MASTER_QUEUE_LEN];
+        if (req->device == mreq->device && req->reg <= mreq->reg && mreq->reg < req->reg + req->count)
+            return true;
+    }
+    return false;
+}
+
+static void start_request(void)
+{
+    bool motion = false;
+    if (mfirst != mlast)
+    {
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        motion = !queued_before(&motion_queue[mfirst]);
+        /* queue is being modified, wait for it to send earlier write */
+        if (!motion && queue_busy)
+            return;
+    }
+
+    if (motion)
+    {
+        const modbus_request *req = &motion_queue[mfirst];
+        poll_cur = -1;
+        motion_cur = true;
+        build_frame(req->device, req->function, req->reg, req->count, req->vals);
+    }
+    else if (qlen > 0 && !queue_busy)
+    {
+        const modbus_request *req = &queue[qfirst];
+        poll_cur = -1;
+        motion_cur = false;
+        build_frame(req->device, req->function, req->reg, req->count, req->vals);
+    }
+    else if (poll_len > 0 && now - last_poll >= MODBUS_POLL_INTERVAL_CHARS)
+    {
+        if (poll_next >= poll_len)
+            poll_next = 0;
+        const modbus_poll_entry *entry = &polls[poll_next];
+        poll_cur = poll_next++;
+        motion_cur = false;
+        last_poll = now;
+        build_frame(entry->device, entry->function, entry->reg, 1, NULL);
+    }
+    else
+    {
+        return;
+    }
+    state = MASTER_TX;
+    port_start_tx();
+}
+
+static uint8_t current_device(void)
+{
+    if (poll_cur >= 0)
+        return polls[poll_cur].device;
+    return current_request()->device;
+}
+
+static uint8_t current_function(void)
+{
+    if (poll_cur >= 0)
+        return polls[poll_cur].function;
+    return current_request()->function;
+}
+
+static void finish_request(void)
+{
+    if (motion_cur)
+    {
+        mfirst = (mfirst + 1) % MODBUS_MASTER_MOTION_QUEUE_LEN;
+        motion_cur = false;
+    }
+    else if (poll_cur < 0)
+    {
+        qfirst = (qfirst + 1) % MODBUS_MASTER_QUEUE_LEN;
+        qlen--;
+    }
+    state = MASTER_IDLE;
+}
+
+static void check_response(void)
+{
+    if (rxlen < MODBUS_HEADER_LEN + 2 ||
+        crc16(rxbuf, rxlen - 2) != (rxbuf[rxlen - 2] | rxbuf[rxlen - 1] << 8) ||
+        rxbuf[0] != current_device() ||
+        rxbuf[1] != current_function())
+    {
+        modbus_master_errors++;
+        return;
+    }
+
+    /* read response: bytes count, values */
+    if (poll_cur >= 0 && poll_cur < poll_len)
+    {
+        if (rxlen < MODBUS_HEADER_LEN + 1 + 2 + 2)
+        {
+            modbus_master_errors++;
+            return;
+        }
+        modbus_poll_entry *entry = &polls[poll_cur];
+        entry->value = rxbuf[3] << 8 | rxbuf[4];
+        entry->time = now;
+        entry->valid = true;
+    }
+}
+
+/* Platform interface, called from interrupts */
+
+int modbus_master_tx_byte(void)
+{
+    if (state != MASTER_TX || txpos >= txlen)
+        return -1;
+    return txbuf[txpos++];
+}
+
+void modbus_master_tx_done(void)
+{
+    if (state != MASTER_TX)
+        return;
+    idle_chars = 0;
+    if (current_device() == 0)
+        finish_request(); // broadcast, no response
+    else
+        state = MASTER_WAIT;
+}
+
+void modbus_master_rx_byte(uint8_t c)
+{
+    if (state == MASTER_WAIT)
+    {
+        state = MASTER_RX;
+        rxlen = 0;
+    }
+    if (state != MASTER_RX)
+        return;
+    if (rxlen < MODBUS_FRAME_LEN)
+        rxbuf[rxlen++] = c;
+    idle_chars = 0;
+}
+
+void modbus_master_char_tick(void)
+{
+    now++;
+    if (idle_chars < UINT16_MAX)
+        idle_chars++;
+
+    switch (state)
+    {
+    case MASTER_IDLE:
+        if (idle_chars >= MODBUS_FRAME_GAP_CHARS)
+            start_request();
+        break;
+    case MASTER_WAIT:
+        if (idle_chars >= MODBUS_RESPONSE_TIMEOUT_CHARS)
+        {
+            modbus_master_errors++;
+            finish_request();
+        }
+        break;
+    case MASTER_RX:
+        if (idle_chars >= MODBUS_FRAME_GAP_CHARS)
+        {
+            check_response();
+            finish_request();
+        }
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+/*
+ * Queued modbus RTU master.
+ *
+ * Requests are added from main context and sent by platform UART
+ * interrupts. Platform must call
+ *  - modbus_master_tx_byte() when UART is ready for next byte,
+ *    until it returns -1
+ *  - modbus_master_tx_done() when last byte is sent out of UART
+ *  - modbus_master_rx_byte() for every received byte
+ *  - modbus_master_char_tick() every character time (11 bits)
+ */
+
+#define MODBUS_MASTER_QUEUE_LEN 8
+#define MODBUS_MASTER_MOTION_QUEUE_LEN 4
+#define MODBUS_MASTER_MAX_REGS 8
+
+#define MODBUS_MASTER_POLL_LEN 8
+
+#define MODBUS_FRAME_GAP_CHARS 4        // >= 3.5 characters of silence
+#define MODBUS_RESPONSE_TIMEOUT_CHARS 100
+#define MODBUS_POLL_INTERVAL_CHARS 50   // between poll requests
+
+extern uint32_t modbus_master_errors;
+
+// Register, which is read periodically, when there are no queued requests
+typedef struct {
+    uint8_t device;
+    uint8_t function;       // FUNCTION_READ_AO or FUNCTION_READ_AI
+    uint16_t reg;
+    uint16_t value;
+    uint32_t time;          // time of last read, characters
+    bool valid;             // value was read at least once
+} modbus_poll_entry;
+
+// start_tx must enable transmitter and UART tx interrupt
+// char_us - time of 1 character (11 bits)
+void modbus_master_init(void (*start_tx)(void), uint16_t char_us);
+
+// queue write of register. Write to register next to previous queued
+// write to the same device is joined with it
+bool modbus_master_write(uint8_t device, uint16_t reg, uint16_t val);
+
+// queue write from motion planner context (steppers interrupt).
+// Such writes have own queue and are sent before others
+bool modbus_master_write_motion(uint8_t device, uint16_t reg, uint16_t val);
+
+// queue write from text command "DDDD:RRRR:VVVV", hex
+bool modbus_master_write_cmd(const char *cmd, size_t len);
+
+// amount of requests, which still can be queued
+int modbus_master_empty_slots(void);
+
+// add register to poll, returns index of entry or -1
+int modbus_master_poll_add(uint8_t device, uint8_t function, uint16_t reg);
+int modbus_master_poll_count(void);
+// get cached entry and its age, age is -1 if it was never read
+bool modbus_master_poll_get(int i, modbus_poll_entry *entry, int32_t *age_ms);
+
+/*
+ * Text commands:
+ *  MB:DDDD:RRRR:VVVV  - write register
+ *  MBP:DDDD:RRRR:FFFF - poll register with function FFFF (0003 or 0004)
+ *  MBR:               - read polled registers, one reply for each
+ * Returns false if line is not a modbus command
+ */
+bool modbus_master_command(const char *line, size_t len,
+                           void (*reply)(const char *msg, ssize_t len));
+
+/* Platform interface */
+int modbus_master_tx_byte(void);
+void modbus_master_tx_done(void);
+void modbus_master_rx_byte(uint8_t c);
+void modbus_master_char_tick(void);
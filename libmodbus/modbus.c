@@ -13,6 +13,31 @@ ssize_t modbus_fill_write_ao(uint8_t *buf, uint16_t reg, uint16_t val)
     return MODBUS_WRITE_AO_LEN;
 }
 
+ssize_t modbus_fill_write_multiple_ao(uint8_t *buf, uint16_t reg, uint16_t count, const uint16_t *vals)
+{
+    int i;
+    buf[0] = (uint8_t)(reg >> 8);
+    buf[1] = (uint8_t)(reg);
+    buf[2] = (uint8_t)(count >> 8);
+    buf[3] = (uint8_t)(count);
+    buf[4] = (uint8_t)(count * 2);
+    for (i = 0; i < count; i++)
+    {
+        buf[5 + 2*i] = (uint8_t)(vals[i] >> 8);
+        buf[5 + 2*i + 1] = (uint8_t)(vals[i]);
+    }
+    return 5 + 2 * count;
+}
+
+ssize_t modbus_fill_read(uint8_t *buf, uint16_t reg, uint16_t count)
+{
+    buf[0] = (uint8_t)(reg >> 8);
+    buf[1] = (uint8_t)(reg);
+    buf[2] = (uint8_t)(count >> 8);
+    buf[3] = (uint8_t)(count);
+    return 4;
+}
+
 uint16_t crc16(const uint8_t *buf, int len)
 {  
     static const uint16_t crcTable[] = {
@@ -82,3 +107,26 @@ ssize_t modbus_fill_header(uint8_t *buf, uint8_t address, uint8_t function, size
     return MODBUS_HEADER_LEN + len + 2;
 }
 
+static int hex2dig(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 0xA;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 0xA;
+    return -1;
+}
+
+int modbus_read_hex16(const char *buf)
+{
+    int i, v = 0;
+    for (i = 0; i < 4; i++)
+    {
+        int d = hex2dig(buf[i]);
+        if (d < 0)
+            return -1;
+        v = v * 0x10 + d;
+    }
+    return v;
+}
@@ -35,5 +35,11 @@ struct modbus_write_ao_s
 #define FUNCTION_WRITE_MULTIPLE_AO	0x10
 
 ssize_t modbus_fill_write_ao(uint8_t *buf, uint16_t reg, uint16_t val);
+ssize_t modbus_fill_write_multiple_ao(uint8_t *buf, uint16_t reg, uint16_t count, const uint16_t *vals);
+ssize_t modbus_fill_read(uint8_t *buf, uint16_t reg, uint16_t count);
+uint16_t crc16(const uint8_t *buf, int len);
 ssize_t modbus_fill_header(uint8_t *buf, uint8_t address, uint8_t function, size_t datalen);
 
+// value of 4 hex digits of command, -1 if they aren't hex
+int modbus_read_hex16(const char *buf);
+
@@ -0,0 +1,211 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <modbus.h>
+#include <master.h>
+
+/*
+ * Loopback of modbus master: frames, sent by master, are read back
+ * here and answered as slave device would do
+ */
+
+static bool tx_started;
+static uint8_t frame[256];
+static int frame_len;
+
+static void start_tx(void)
+{
+    tx_started = true;
+}
+
+// tick until master starts frame, read it out of tx. -1 if nothing is sent
+static int wait_frame(int max_ticks)
+{
+    int i, c;
+    for (i = 0; i < max_ticks && !tx_started; i++)
+        modbus_master_char_tick();
+    if (!tx_started)
+        return -1;
+    tx_started = false;
+    frame_len = 0;
+    while ((c = modbus_master_tx_byte()) >= 0)
+        frame[frame_len++] = c;
+    modbus_master_tx_done();
+    return frame_len;
+}
+
+static void respond(const uint8_t *data, int len)
+{
+    int i;
+    for (i = 0; i < len; i++)
+        modbus_master_rx_byte(data[i]);
+    for (i = 0; i < MODBUS_FRAME_GAP_CHARS; i++)
+        modbus_master_char_tick();
+}
+
+static void expect_frame(const uint8_t *data, int len)
+{
+    assert(wait_frame(1000) == len);
+    assert(!memcmp(frame, data, len));
+}
+
+static char reply_buf[64];
+static int reply_len;
+
+static void reply(const char *msg, ssize_t len)
+{
+    if (len < 0)
+        len = strlen(msg);
+    memcpy(reply_buf, msg, len);
+    reply_len = len;
+}
+
+void test_write(void)
+{
+    static const uint8_t req[] = {0x01, 0x06, 0x00, 0x10, 0x00, 0xFF, 0xC8, 0x4F};
+    uint32_t errors = modbus_master_errors;
+    printf("\ntest_write\n");
+
+    modbus_master_init(start_tx, 1000);
+    assert(modbus_master_command("MB:0001:0010:00FF", 17, reply));
+    assert(modbus_master_empty_slots() == MODBUS_MASTER_QUEUE_LEN - 1);
+
+    expect_frame(req, sizeof(req));
+    respond(req, sizeof(req));
+    assert(modbus_master_errors == errors);
+    assert(modbus_master_empty_slots() == MODBUS_MASTER_QUEUE_LEN);
+    assert(wait_frame(1000) < 0);
+}
+
+void test_join(void)
+{
+    static const uint8_t req[] = {0x01, 0x10, 0x00, 0x10, 0x00, 0x02, 0x04,
+                                  0x00, 0x01, 0x00, 0x02, 0x22, 0xA2};
+    static const uint8_t resp[] = {0x01, 0x10, 0x00, 0x10, 0x00, 0x02, 0x40, 0x0D};
+    uint32_t errors = modbus_master_errors;
+    printf("\ntest_join\n");
+
+    modbus_master_init(start_tx, 1000);
+    assert(modbus_master_write(1, 0x10, 1));
+    assert(modbus_master_write(1, 0x11, 2));
+    assert(modbus_master_empty_slots() == MODBUS_MASTER_QUEUE_LEN - 1);
+
+    expect_frame(req, sizeof(req));
+    respond(resp, sizeof(resp));
+    assert(modbus_master_errors == errors);
+    assert(modbus_master_empty_slots() == MODBUS_MASTER_QUEUE_LEN);
+}
+
+void test_bad_crc(void)
+{
+    static const uint8_t req[] = {0x01, 0x06, 0x00, 0x10, 0x00, 0xFF, 0xC8, 0x4F};
+    uint8_t resp[sizeof(req)];
+    uint32_t errors = modbus_master_errors;
+    printf("\ntest_bad_crc\n");
+
+    modbus_master_init(start_tx, 1000);
+    assert(modbus_master_write(1, 0x10, 0xFF));
+    expect_frame(req, sizeof(req));
+
+    memcpy(resp, req, sizeof(req));
+    resp[sizeof(resp) - 1] ^= 1;
+    respond(resp, sizeof(resp));
+    assert(modbus_master_errors == errors + 1);
+
+    /* request isn't repeated */
+    assert(modbus_master_empty_slots() == MODBUS_MASTER_QUEUE_LEN);
+}
+
+void test_timeout(void)
+{
+    static const uint8_t req[] = {0x01, 0x06, 0x00, 0x10, 0x00, 0xFF, 0xC8, 0x4F};
+    int i;
+    uint32_t errors = modbus_master_errors;
+    printf("\ntest_timeout\n");
+
+    modbus_master_init(start_tx, 1000);
+    assert(modbus_master_write(1, 0x10, 0xFF));
+    assert(modbus_master_write(2, 0x10, 0xFF));
+    expect_frame(req, sizeof(req));
+
+    /* no response */
+    for (i = 0; i < MODBUS_RESPONSE_TIMEOUT_CHARS - 1; i++)
+        modbus_master_char_tick();
+    assert(modbus_master_errors == errors);
+    assert(!tx_started);
+    modbus_master_char_tick();
+    assert(modbus_master_errors == errors + 1);
+
+    /* next request is sent after timeout */
+    assert(wait_frame(1000) == sizeof(req));
+    assert(frame[0] == 2);
+}
+
+void test_motion_first(void)
+{
+    printf("\ntest_motion_first\n");
+
+    modbus_master_init(start_tx, 1000);
+    assert(modbus_master_write(1, 0x10, 1));
+    assert(modbus_master_write_motion(0, 0x20, 2));
+
+    /* broadcast isn't answered */
+    assert(wait_frame(1000) == 8);
+    assert(frame[0] == 0 && frame[3] == 0x20);
+    assert(wait_frame(1000) == 8);
+    assert(frame[0] == 1 && frame[3] == 0x10);
+}
+
+void test_motion_order(void)
+{
+    printf("\ntest_motion_order\n");
+
+    modbus_master_init(start_tx, 1000);
+    assert(modbus_master_write(0, 0x10, 1));
+    assert(modbus_master_write(0, 0x11, 2));
+    assert(modbus_master_write_motion(0, 0x11, 3));
+
+    /* earlier write to the same register is sent first */
+    assert(wait_frame(1000) > 8);
+    assert(frame[0] == 0 && frame[1] == 0x10 && frame[3] == 0x10);
+    assert(wait_frame(1000) == 8);
+    assert(frame[0] == 0 && frame[3] == 0x11 && frame[5] == 3);
+}
+
+void test_poll(void)
+{
+    static const uint8_t req[] = {0x02, 0x03, 0x00, 0x20, 0x00, 0x01, 0x85, 0xF3};
+    static const uint8_t resp[] = {0x02, 0x03, 0x02, 0x12, 0x34, 0xF1, 0x33};
+    modbus_poll_entry entry;
+    int32_t age;
+    uint32_t errors = modbus_master_errors;
+    printf("\ntest_poll\n");
+
+    modbus_master_init(start_tx, 1000);
+    assert(modbus_master_command("MBP:0002:0020:0003", 18, reply));
+    assert(modbus_master_poll_get(0, &entry, &age));
+    assert(!entry.valid && age == -1);
+
+    expect_frame(req, sizeof(req));
+    respond(resp, sizeof(resp));
+    assert(modbus_master_errors == errors);
+    assert(modbus_master_poll_get(0, &entry, &age));
+    assert(entry.valid && entry.value == 0x1234);
+
+    assert(modbus_master_command("MBR:", 4, reply));
+    printf("%.*s\n", reply_len, reply_buf);
+    assert(reply_len > 21 && !memcmp(reply_buf, "MBR:0002:0020=1234 T:", 21));
+}
+
+int main(void)
+{
+    test_write();
+    test_join();
+    test_bad_crc();
+    test_timeout();
+    test_motion_first();
+    test_motion_order();
+    test_poll();
+    return 0;
+}
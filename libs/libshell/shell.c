@@ -1,11 +1,11 @@
 #include <stdbool.h>
 #include <string.h>
-#include <stdio.h>
 
 #include <shell.h>
 
 #ifdef CONFIG_LIBCORE
 #include <output/output.h>
+#include <output/format.h>
 #include <control/commands/gcode_handler/gcode_handler.h>
 #endif
 
@@ -13,19 +13,36 @@
 #include <modbus.h>
 #endif
 
+#ifdef CONFIG_MODBUS_MASTER
+#include <master.h>
+#endif
+
 uint32_t shell_fails = 0;
 
-static char messages[SHELL_RING_LEN][SHELL_MSG_LEN];
-static int mpos = 0;
-static int mfirst = 0;
+/*
+ * Output messages are stored in byte ring as [len hi][len lo][data].
+ * Message is never split by end of ring: if it doesn't fit in the end,
+ * it is placed at 0 and ring is shortened to mwrap until it is read.
+ */
+static uint8_t messages[SHELL_RING_BYTES];
+static size_t mfirst = 0;
+static size_t mlast = 0;
+static size_t mwrap = SHELL_RING_BYTES;
+static size_t mreserved = 0;
 static int mnum = 0;
 
-static char input_buffer[SHELL_MSG_LEN];
+/*
+ * Input is a stream of lines, terminated by \n or \r. Packet may contain
+ * several lines, line may be split between packets.
+ */
+static char input_buffer[SHELL_INPUT_LEN];
 
 #ifdef CONFIG_COPY_COMMAND
-static char command_buffer[SHELL_MSG_LEN-3];
+static char command_buffer[SHELL_INPUT_LEN-3];
 #endif
-static int input_pos = 0;
+static size_t input_pos = 0;          // end of received data
+static size_t input_lines_end = 0;    // end of last complete line
+static bool input_skip = false;       // skip line, which doesn't fit in buffer
 
 static void (*debug_send)(const uint8_t *data, ssize_t len);
 static void (*uart_send)(const uint8_t *data, size_t len);
@@ -35,37 +52,81 @@ static void shell_pop_message(void)
     if (mnum == 0)
         return;
     mnum--;
-    mfirst = (mfirst + 1) % SHELL_RING_LEN;
+    if (mnum == 0)
+    {
+        mfirst = mlast = 0;
+        mwrap = SHELL_RING_BYTES;
+        return;
+    }
+    mfirst += 2 + (messages[mfirst] << 8 | messages[mfirst + 1]);
+    if (mfirst >= mwrap)
+    {
+        mfirst = 0;
+        mwrap = SHELL_RING_BYTES;
+    }
 }
 
-bool shell_add_message(const char *msg, ssize_t len)
+char *shell_reserve_message(size_t len)
 {
-    if (mnum == SHELL_RING_LEN)
+    size_t need = len + 2;
+    size_t pos;
+
+    if (len > SHELL_MSG_LEN)
+        goto fail;
+
+    if (mnum > 0 && mlast <= mfirst)
     {
-        shell_fails++;
-        return false;
+        if (mfirst - mlast < need)
+            goto fail;
+        pos = mlast;
     }
-    if (len < 0)
-        len = strlen(msg);
+    else if (SHELL_RING_BYTES - mlast >= need)
+    {
+        pos = mlast;
+    }
+    else
+    {
+        if (mfirst < need)
+            goto fail;
+        pos = 0;
+    }
+
+    mreserved = pos;
+    return (char *)messages + pos + 2;
 
-    len = len < SHELL_MSG_LEN - 2 ? len : SHELL_MSG_LEN - 2;
-    memset(messages[mpos], 0, SHELL_MSG_LEN);
-    messages[mpos][0] = len >> 8;
-    messages[mpos][1] = len;
-    strncpy(messages[mpos]+2, msg, len);
-    mpos = (mpos + 1) % SHELL_RING_LEN;
+fail:
+    shell_fails++;
+    return NULL;
+}
+
+void shell_commit_message(size_t len)
+{
+    size_t pos = mreserved;
+    if (pos == 0 && mlast != 0)
+        mwrap = mlast;
+    messages[pos] = len >> 8;
+    messages[pos + 1] = len;
+    mlast = pos + 2 + len;
     mnum++;
-    return true;
 }
 
-static bool shell_has_pending_messages(void)
+bool shell_add_message(const char *msg, ssize_t len)
 {
-    return mnum > 0;
+    if (len < 0)
+        len = strlen(msg);
+    if (len > SHELL_MSG_LEN)
+        len = SHELL_MSG_LEN;
+
+    char *buf = shell_reserve_message(len);
+    if (buf == NULL)
+        return false;
+    memcpy(buf, msg, len);
+    shell_commit_message(len);
+    return true;
 }
 
 static ssize_t write_fun(int fd, const void *data, ssize_t len)
 {
-    int i;
     if (len < 0)
         len = strlen((const char *)data);
     if (fd == 0)
@@ -92,87 +153,98 @@ const uint8_t *shell_pick_message(ssize_t *len)
 {
     if (mnum > 0)
     {
-        *len = ((int)messages[mfirst][0]) << 8 | messages[mfirst][1];
-        return messages[mfirst] + 2;
+        *len = messages[mfirst] << 8 | messages[mfirst + 1];
+        return messages + mfirst + 2;
     }
     *len = -1;
     return NULL;
 }
 
+// Amount of messages of max length, which still can be added
 int shell_empty_slots(void)
 {
-    return SHELL_RING_LEN - mnum;
+    size_t len = SHELL_MSG_LEN + 2;
+    if (mnum == 0)
+        return SHELL_RING_BYTES / len;
+    if (mlast <= mfirst)
+        return (mfirst - mlast) / len;
+    return (SHELL_RING_BYTES - mlast) / len + mfirst / len;
+}
+
+#ifdef CONFIG_MODBUS_MASTER
+static void shell_reply(const char *msg, ssize_t len)
+{
+    shell_add_message(msg, len);
 }
+#endif
 
-static int hex2dig(char c)
+static bool is_eol(char c)
 {
-    if (c >= '0' && c <= '9')
-        return c - '0';
-    if (c >= 'A' && c <= 'F')
-        return c - 'A' + 0xA;
-    if (c >= 'a' && c <= 'f')
-        return c - 'a' + 0xA;
-    return -1;
+    return c == '\n' || c == '\r';
 }
 
 bool shell_data_received(const char *data, ssize_t len)
 {
     int i;
+    bool ok = true;
     if (len < 0)
         len = strlen(data);
 
-    if (input_pos + len > SHELL_MSG_LEN)
-    {
-        input_pos = 0;
-        return false;
-    }
-    memcpy(input_buffer + input_pos, data, len);
     for (i = 0; i < len; i++)
     {
-        if (input_buffer[i + input_pos] == '\n' || input_buffer[i + input_pos] == '\r')
-            input_buffer[i + input_pos] = ' ';
+        char c = data[i];
+        if (input_skip)
+        {
+            // tail of too long line
+            if (is_eol(c))
+                input_skip = false;
+            continue;
+        }
+        if (input_pos == SHELL_INPUT_LEN)
+        {
+            // drop partial line, complete lines are kept
+            input_pos = input_lines_end;
+            input_skip = !is_eol(c);
+            ok = false;
+            continue;
+        }
+        input_buffer[input_pos++] = c;
+        if (is_eol(c))
+            input_lines_end = input_pos;
     }
-
-    input_pos += len;
-    return true;
+    return ok;
 }
 
-void shell_data_completed(void)
+static void shell_process_line(const char *line, size_t len)
 {
-    if (input_pos >= 6 && !memcmp(input_buffer, "START:", 6))
+    if (len >= 6 && !memcmp(line, "START:", 6))
     {
         // Do nothing
     }
 #ifdef CONFIG_LIBCORE
-    else if (input_pos >= 3 && !memcmp(input_buffer, "RT:", 3))
+    else if (len >= 3 && !memcmp(line, "RT:", 3))
     {
 #ifdef CONFIG_COPY_COMMAND
-        memcpy(command_buffer, input_buffer+3, input_pos-3);
-        execute_g_command(command_buffer, input_pos - 3);
+        memcpy(command_buffer, line+3, len-3);
+        execute_g_command(command_buffer, len - 3);
 #else
-        execute_g_command(input_buffer+3, input_pos - 3);
+        execute_g_command(line+3, len - 3);
 #endif
     }
 #endif
 
-#ifdef CONFIG_LIBMODBUS
-    else if (input_pos >= 3 && !memcmp(input_buffer, "MB:", 3))
-    {
-        int i;
-        const char *buf = input_buffer + 3;
-        uint8_t addrs[4], vals[4], devids[4];
-        memcpy(devids, buf, 4);
-        memcpy(addrs, buf+4+1, 4);
-        memcpy(vals, buf+4+1+4+1, 4);
-        for (i = 0; i < 4; i++)
-        {
-            devids[i] = hex2dig(devids[i]);
-            addrs[i] = hex2dig(addrs[i]);
-            vals[i] = hex2dig(vals[i]);
-        }
-        uint16_t addr  =  addrs[0] * 0x1000 +  addrs[1] * 0x100 +  addrs[2] * 0x10 +  addrs[3];
-        uint16_t val   =   vals[0] * 0x1000 +   vals[1] * 0x100 +   vals[2] * 0x10 +   vals[3];
-        uint16_t devid = devids[0] * 0x1000 + devids[1] * 0x100 + devids[2] * 0x10 + devids[3];
+#ifdef CONFIG_MODBUS_MASTER
+    else if (modbus_master_command(line, len, shell_reply))
+    {
+        // Done
+    }
+#elif defined(CONFIG_LIBMODBUS)
+    else if (len >= 3 + 4+1+4+1+4 && !memcmp(line, "MB:", 3))
+    {
+        const char *buf = line + 3;
+        uint16_t devid = modbus_read_hex16(buf);
+        uint16_t addr  = modbus_read_hex16(buf+4+1);
+        uint16_t val   = modbus_read_hex16(buf+4+1+4+1);
 
 #define PREAMBLE 0
         uint8_t buffer[40];
@@ -187,25 +259,50 @@ void shell_data_completed(void)
 #undef PREAMBLE
     }
 #endif
-    else if (input_pos >= 5 && !memcmp(input_buffer, "EXIT:", 5))
+    else if (len >= 5 && !memcmp(line, "EXIT:", 5))
     {
         // Do nothing
     }
 #ifdef CONFIG_ECHO
-    else if (input_pos >= 5 && !memcmp(input_buffer, "ECHO:", 5))
+    else if (len >= 5 && !memcmp(line, "ECHO:", 5))
     {
         // Send echo back
-        shell_add_message(input_buffer, input_pos);
+        shell_add_message(line, len);
     }
 #endif
     else
     {
-        char buf[SHELL_MSG_LEN-2];
-        int l = snprintf(buf, 100, "Unknown command: %i [%.*s]", input_pos, input_pos, input_buffer);
-        shell_add_message(buf, l);
+#ifdef CONFIG_LIBCORE
+        char buf[SHELL_MSG_LEN];
+        char *end = buf + sizeof(buf);
+        char *p = fmt_str(buf, end, "Unknown command: ");
+        p = fmt_int(p, end, len);
+        p = fmt_str(p, end, " [");
+        p = fmt_mem(p, end, line, len);
+        p = fmt_str(p, end, "]");
+        shell_add_message(buf, p - buf);
+#else
+        shell_add_message("Unknown command", -1);
+#endif
+    }
+}
+
+// Execute all complete lines, partial line is kept for next data
+void shell_data_completed(void)
+{
+    size_t i, start = 0;
+    for (i = 0; i < input_lines_end; i++)
+    {
+        if (!is_eol(input_buffer[i]))
+            continue;
+        if (i > start)
+            shell_process_line(input_buffer + start, i - start);
+        start = i + 1;
     }
 
-    input_pos = 0;
+    memmove(input_buffer, input_buffer + input_lines_end, input_pos - input_lines_end);
+    input_pos -= input_lines_end;
+    input_lines_end = 0;
 }
 
 void shell_setup(void (*debug_send_fun)(const uint8_t *, ssize_t), void (*uart_send_fun)(const uint8_t *data, size_t len))
@@ -214,6 +311,7 @@ void shell_setup(void (*debug_send_fun)(const uint8_t *, ssize_t), void (*uart_s
     debug_send = debug_send_fun;
 #ifdef CONFIG_LIBCORE
     output_set_write_fun(write_fun);
+    output_set_control_reserve_fun(shell_reserve_message, shell_commit_message);
     output_control_set_fd(0);
     output_shell_set_fd(1);
 #endif
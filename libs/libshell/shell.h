@@ -17,6 +17,10 @@ const uint8_t *shell_pick_message(ssize_t *len);
 int shell_empty_slots(void);
 bool shell_add_message(const char *msg, ssize_t len);
 
+/* Reserve place for message of at most len bytes, write it in place and commit actual length */
+char *shell_reserve_message(size_t len);
+void shell_commit_message(size_t len);
+
 /* Input methods */
 bool shell_data_received(const char *data, ssize_t len);
 void shell_data_completed(void);
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# Modbus RTU slave stand-in for testing of modbus master,
+# for example with emulator: controller.elf -m /tmp/modbus
+# modbus-slave.py /tmp/modbus [address]
+
+import os
+import select
+import sys
+import termios
+import tty
+
+port = sys.argv[1]
+address = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+gap = 0.005
+
+regs = {}
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for i in range(8):
+            if crc & 1:
+                crc = (crc >> 1) ^ 0xA001
+            else:
+                crc >>= 1
+    return crc
+
+def frame(data):
+    crc = crc16(data)
+    return bytes(data) + bytes([crc & 0xFF, crc >> 8])
+
+def handle(req):
+    if len(req) < 4 or crc16(req[:-2]) != (req[-2] | req[-1] << 8):
+        print("bad frame", req.hex(), flush=True)
+        return None
+    dev, fn, data = req[0], req[1], req[2:-2]
+    if dev != address and dev != 0:
+        return None
+    if fn == 0x06:
+        reg = data[0] << 8 | data[1]
+        regs[reg] = data[2] << 8 | data[3]
+        print("write dev %i reg %i vals %s" % (dev, reg, [regs[reg]]), flush=True)
+        resp = req[:-2]
+    elif fn == 0x10:
+        reg = data[0] << 8 | data[1]
+        cnt = data[2] << 8 | data[3]
+        vals = [data[5 + 2*i] << 8 | data[6 + 2*i] for i in range(cnt)]
+        for i in range(cnt):
+            regs[reg + i] = vals[i]
+        print("write dev %i reg %i vals %s" % (dev, reg, vals), flush=True)
+        resp = req[:6]
+    elif fn == 0x03 or fn == 0x04:
+        reg = data[0] << 8 | data[1]
+        cnt = data[2] << 8 | data[3]
+        vals = [regs.get(reg + i, 0) for i in range(cnt)]
+        resp = [dev, fn, 2 * cnt]
+        for v in vals:
+            resp += [v >> 8, v & 0xFF]
+    else:
+        print("unsupported function %i" % fn, flush=True)
+        resp = [dev, fn | 0x80, 1]
+    if dev == 0:
+        return None
+    return frame(resp)
+
+fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+tty.setraw(fd)
+buf = b''
+while True:
+    r, _, _ = select.select([fd], [], [], gap if buf else None)
+    if r:
+        buf += os.read(fd, 256)
+        continue
+    resp = handle(buf)
+    buf = b''
+    if resp:
+        os.write(fd, resp)